@@ -0,0 +1,474 @@
+#pragma once
+
+/* C++20 coroutine variants of safe_queue and the mutexes: suspended coroutines
+ * are linked through awaiters living in their own frames, so waiting allocates
+ * nothing. they resume through Executor::resume(node) when the executor has one,
+ * otherwise through Executor::post(fn), so app::thread_pool works as is */
+
+#if defined(__has_include)
+#   if __has_include(<coroutine>) && defined(__cpp_impl_coroutine)
+#       define APP_HAS_COROUTINE 1
+#   endif
+#endif
+
+#ifdef APP_HAS_COROUTINE
+
+#include <mutex>
+#include <deque>
+#include <utility>
+#include <optional>
+#include <coroutine>
+
+namespace app
+{
+
+/* a suspended coroutine as linked by the awaiters, first in waiter lists and then in
+ * the executor's queue; lives in the coroutine frame until the coroutine resumes */
+struct resume_node
+{
+    std::coroutine_handle<>     handle_;
+    resume_node*                next_       { nullptr };
+};
+
+/* intrusive fifo of resume_node derived Node */
+template <typename Node>
+class waiter_list
+{
+public:
+    bool empty() const
+    {
+        return head_ == nullptr;
+    }
+
+    Node* front() const
+    {
+        return head_;
+    }
+
+    void push_back(Node* node)
+    {
+        node->next_ = nullptr;
+        if (tail_) {
+            tail_->next_ = node;
+        }
+        else {
+            head_ = node;
+        }
+        tail_ = node;
+    }
+
+    Node* pop_front()
+    {
+        Node* node = head_;
+        head_ = static_cast<Node*>(node->next_);
+        if (head_ == nullptr) {
+            tail_ = nullptr;
+        }
+        return node;
+    }
+
+private:
+    Node*   head_   { nullptr };
+    Node*   tail_   { nullptr };
+};
+
+/* resumes on the thread that releases the item or lock. a resume made while a resumed
+ * coroutine runs is linked into the thread's pending list and drained by the outermost
+ * call, so a chain of waiters each releasing to the next resumes in a loop, not on an
+ * ever deeper stack. the nodes are the awaiters themselves, nothing is allocated */
+struct inline_executor
+{
+    void resume(resume_node* node)
+    {
+        trampoline& tramp = current();
+        if (tramp.running) {
+            tramp.pending.push_back(node);
+            return;
+        }
+
+        running_guard guard(tramp);
+        node->handle_.resume();
+        while (!tramp.pending.empty()) {
+            // the frame holding the node may be gone once its coroutine runs
+            std::coroutine_handle<> handle = tramp.pending.pop_front()->handle_;
+            handle.resume();
+        }
+    }
+
+private:
+    struct trampoline
+    {
+        bool                        running     { false };
+        waiter_list<resume_node>    pending;
+    };
+
+    struct running_guard
+    {
+        explicit running_guard(trampoline& tramp)
+            : tramp_(tramp)
+        {
+            tramp_.running = true;
+        }
+
+        ~running_guard()
+        {
+            tramp_.running = false;
+        }
+
+        trampoline& tramp_;
+    };
+
+    static trampoline& current()
+    {
+        static thread_local trampoline tramp;
+        return tramp;
+    }
+};
+
+/* hands a popped waiter to the executor */
+template <typename Executor>
+inline void resume_on(Executor& exec, resume_node* node)
+{
+    if constexpr (requires { exec.resume(node); }) {
+        exec.resume(node);
+    }
+    else {
+        std::coroutine_handle<> handle = node->handle_;
+        exec.post([handle]() { handle.resume(); });
+    }
+}
+
+template <typename Executor>
+inline Executor& default_executor()
+{
+    static Executor exec;
+    return exec;
+}
+
+
+/* co_await queue.pop() */
+template <typename T, typename Executor = inline_executor>
+class async_queue
+{
+public:
+    class pop_awaiter : public resume_node
+    {
+    public:
+        explicit pop_awaiter(async_queue& queue)
+            : queue_(queue)
+        {
+        }
+
+        bool await_ready()
+        {
+            return false;
+        }
+
+        bool await_suspend(std::coroutine_handle<> handle)
+        {
+            std::lock_guard<std::mutex> lck(queue_.mtx_);
+            if (!queue_.queue_.empty()) {
+                value_.emplace(std::move(queue_.queue_.front()));
+                queue_.queue_.pop_front();
+                return false;
+            }
+
+            handle_ = handle;
+            queue_.waiters_.push_back(this);
+            return true;
+        }
+
+        T await_resume()
+        {
+            return std::move(*value_);
+        }
+
+    private:
+        friend class async_queue;
+
+        async_queue&            queue_;
+        std::optional<T>        value_;
+    };
+
+    explicit async_queue(Executor& exec = default_executor<Executor>())
+        : exec_(exec)
+    {
+    }
+
+    /* hands the item straight to the oldest waiter if there is one */
+    void push(T t)
+    {
+        std::unique_lock<std::mutex> lck(mtx_);
+        if (waiters_.empty()) {
+            queue_.push_back(std::move(t));
+            return;
+        }
+
+        pop_awaiter* waiter = waiters_.pop_front();
+        waiter->value_.emplace(std::move(t));
+        lck.unlock();
+
+        resume_on(exec_, waiter);
+    }
+
+    pop_awaiter pop()
+    {
+        return pop_awaiter(*this);
+    }
+
+    bool try_pop(T& val)
+    {
+        std::lock_guard<std::mutex> lck(mtx_);
+        if (queue_.empty()) {
+            return false;
+        }
+        val = std::move(queue_.front());
+        queue_.pop_front();
+        return true;
+    }
+
+    size_t size() const
+    {
+        std::lock_guard<std::mutex> lck(mtx_);
+        return queue_.size();
+    }
+
+private:
+    async_queue(const async_queue&) = delete;
+    async_queue& operator=(const async_queue&) = delete;
+
+private:
+    Executor&                   exec_;
+    mutable std::mutex          mtx_;
+    std::deque<T>               queue_;
+    waiter_list<pop_awaiter>    waiters_;
+};
+
+
+/* co_await mutex.lock_async(); ... mutex.unlock(); unlock hands ownership to the oldest waiter */
+template <typename Executor = inline_executor>
+class async_mutex
+{
+public:
+    class lock_awaiter : public resume_node
+    {
+    public:
+        explicit lock_awaiter(async_mutex& mutex)
+            : mutex_(mutex)
+        {
+        }
+
+        bool await_ready()
+        {
+            return mutex_.try_lock();
+        }
+
+        bool await_suspend(std::coroutine_handle<> handle)
+        {
+            std::lock_guard<std::mutex> lck(mutex_.mtx_);
+            if (!mutex_.locked_) {
+                mutex_.locked_ = true;
+                return false;
+            }
+
+            handle_ = handle;
+            mutex_.waiters_.push_back(this);
+            return true;
+        }
+
+        void await_resume()
+        {
+        }
+
+    private:
+        friend class async_mutex;
+
+        async_mutex&            mutex_;
+    };
+
+    explicit async_mutex(Executor& exec = default_executor<Executor>())
+        : exec_(exec)
+    {
+    }
+
+    lock_awaiter lock_async()
+    {
+        return lock_awaiter(*this);
+    }
+
+    bool try_lock()
+    {
+        std::lock_guard<std::mutex> lck(mtx_);
+        if (locked_) {
+            return false;
+        }
+        locked_ = true;
+        return true;
+    }
+
+    void unlock()
+    {
+        std::unique_lock<std::mutex> lck(mtx_);
+        if (waiters_.empty()) {
+            locked_ = false;
+            return;
+        }
+
+        lock_awaiter* waiter = waiters_.pop_front();
+        lck.unlock();
+
+        resume_on(exec_, waiter);
+    }
+
+private:
+    async_mutex(const async_mutex&) = delete;
+    async_mutex& operator=(const async_mutex&) = delete;
+
+private:
+    Executor&                   exec_;
+    std::mutex                  mtx_;
+    bool                        locked_     { false };
+    waiter_list<lock_awaiter>   waiters_;
+};
+
+
+/* fifo reader-writer lock: a release wakes either the next writer or the run of readers at the front */
+template <typename Executor = inline_executor>
+class async_shared_mutex
+{
+public:
+    class lock_awaiter : public resume_node
+    {
+    public:
+        lock_awaiter(async_shared_mutex& mutex, bool exclusive)
+            : mutex_(mutex), exclusive_(exclusive)
+        {
+        }
+
+        bool await_ready()
+        {
+            return exclusive_ ? mutex_.try_lock() : mutex_.try_lock_shared();
+        }
+
+        bool await_suspend(std::coroutine_handle<> handle)
+        {
+            std::lock_guard<std::mutex> lck(mutex_.mtx_);
+            if (mutex_.acquire(exclusive_)) {
+                return false;
+            }
+
+            handle_ = handle;
+            mutex_.waiters_.push_back(this);
+            return true;
+        }
+
+        void await_resume()
+        {
+        }
+
+    private:
+        friend class async_shared_mutex;
+
+        async_shared_mutex&     mutex_;
+        bool                    exclusive_;
+    };
+
+    explicit async_shared_mutex(Executor& exec = default_executor<Executor>())
+        : exec_(exec)
+    {
+    }
+
+    lock_awaiter lock_async()
+    {
+        return lock_awaiter(*this, true);
+    }
+
+    lock_awaiter lock_shared_async()
+    {
+        return lock_awaiter(*this, false);
+    }
+
+    bool try_lock()
+    {
+        std::lock_guard<std::mutex> lck(mtx_);
+        return acquire(true);
+    }
+
+    bool try_lock_shared()
+    {
+        std::lock_guard<std::mutex> lck(mtx_);
+        return acquire(false);
+    }
+
+    void unlock()
+    {
+        std::unique_lock<std::mutex> lck(mtx_);
+        state_ = 0;
+        wake(lck);
+    }
+
+    void unlock_shared()
+    {
+        std::unique_lock<std::mutex> lck(mtx_);
+        if (--state_ == 0) {
+            wake(lck);
+        }
+    }
+
+private:
+    /* state_: -1 writer, n > 0 readers; new arrivals queue behind waiters */
+    bool acquire(bool exclusive)
+    {
+        if (!waiters_.empty()) {
+            return false;
+        }
+
+        if (exclusive) {
+            if (state_ != 0) {
+                return false;
+            }
+            state_ = -1;
+            return true;
+        }
+
+        if (state_ < 0) {
+            return false;
+        }
+        ++state_;
+        return true;
+    }
+
+    void wake(std::unique_lock<std::mutex>& lck)
+    {
+        waiter_list<lock_awaiter> ready;
+        if (!waiters_.empty() && waiters_.front()->exclusive_) {
+            state_ = -1;
+            ready.push_back(waiters_.pop_front());
+        }
+        else {
+            while (!waiters_.empty() && !waiters_.front()->exclusive_) {
+                ++state_;
+                ready.push_back(waiters_.pop_front());
+            }
+        }
+        lck.unlock();
+
+        while (!ready.empty()) {
+            resume_on(exec_, ready.pop_front());
+        }
+    }
+
+private:
+    async_shared_mutex(const async_shared_mutex&) = delete;
+    async_shared_mutex& operator=(const async_shared_mutex&) = delete;
+
+private:
+    Executor&                   exec_;
+    std::mutex                  mtx_;
+    int                         state_      { 0 };
+    waiter_list<lock_awaiter>   waiters_;
+};
+
+};
+
+#endif
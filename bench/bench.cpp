@@ -0,0 +1,632 @@
+/* scaling benchmark for the primitives against their std equivalents.
+ * writes one csv row per configuration to stdout:
+ *   mt_bench [--threads=1,2,4,8] [--duration=200] [--suite=lock,rw,queue,map,combine,counter]
+ *            [--reads=50,90,99] [--cs=0,64,512] [--keys=65536] [--zipf=0.99]
+ */
+
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <string>
+#include <vector>
+#include <thread>
+#include <atomic>
+#include <chrono>
+#include <random>
+#include <algorithm>
+#include <mutex>
+#include <shared_mutex>
+#include <deque>
+#include <memory>
+#include <queue>
+#include <unordered_map>
+#include <condition_variable>
+
+#include "spinlock.h"
+#include "shared_mutex.h"
+#include "safequeue.hpp"
+#include "unordered_map.hpp"
+#include "flat_combining.hpp"
+#include "striped_counter.hpp"
+#include "read_cache.hpp"
+
+namespace bench
+{
+
+typedef std::chrono::steady_clock   clock;
+typedef std::mt19937_64             rng_type;
+
+struct config
+{
+    std::vector<int>            threads     { 1, 2, 4, 8 };
+    std::vector<int>            reads       { 50, 90, 99 };
+    std::vector<int>            cs          { 0, 64, 512 };
+    std::vector<std::string>    suites      { "lock", "rw", "queue", "map", "combine", "counter" };
+    int                         duration    { 200 };
+    size_t                      keys        { 1 << 16 };
+    double                      zipf        { 0.99 };
+};
+
+struct row
+{
+    const char*     suite;
+    const char*     primitive;
+    int             threads;
+    int             read_pct;
+    int             cs;
+    const char*     dist;
+    int             producers;
+    int             consumers;
+};
+
+struct result
+{
+    uint64_t                ops     { 0 };
+    double                  secs    { 0 };
+    std::vector<uint32_t>   lat;
+};
+
+/* busy work inside the critical section, iterations not nanoseconds */
+inline void spin_work(int iters)
+{
+    for (volatile int i = 0; i < iters; ++i);
+}
+
+/* zipf distributed key ranks, s = 0 degrades to uniform */
+class zipf_keys
+{
+public:
+    zipf_keys(size_t n, double s)
+        : cdf_(n)
+    {
+        double sum = 0;
+        for (size_t i = 0; i < n; ++i) {
+            sum += 1.0 / std::pow(double(i + 1), s);
+            cdf_[i] = sum;
+        }
+        for (auto& c : cdf_) {
+            c /= sum;
+        }
+    }
+
+    size_t operator()(rng_type& rng) const
+    {
+        double u = std::uniform_real_distribution<double>(0, 1)(rng);
+        return std::lower_bound(cdf_.begin(), cdf_.end(), u) - cdf_.begin();
+    }
+
+private:
+    std::vector<double>     cdf_;
+};
+
+/* op(tid, rng) returns whether it completed one unit of work, every 16th op is timed */
+template <typename Op>
+result run(int threads, int duration, Op op)
+{
+    std::atomic<bool> start { false };
+    std::atomic<bool> stop  { false };
+    std::vector<uint64_t> ops(threads);
+    std::vector<std::vector<uint32_t>> lats(threads);
+    std::vector<std::thread> workers;
+
+    for (int tid = 0; tid < threads; ++tid) {
+        workers.emplace_back([&, tid]() {
+            rng_type rng(tid * 7919 + 1);
+            auto& lat = lats[tid];
+            uint64_t done = 0;
+            while (!start.load(std::memory_order_acquire)) {
+                std::this_thread::yield();
+            }
+
+            for (uint64_t n = 0; !stop.load(std::memory_order_relaxed); ++n) {
+                if ((n & 15) != 0) {
+                    done += op(tid, rng) ? 1 : 0;
+                    continue;
+                }
+
+                auto begin = clock::now();
+                bool ok = op(tid, rng);
+                if (ok) {
+                    ++done;
+                    lat.push_back(uint32_t(std::min<int64_t>(UINT32_MAX,
+                        std::chrono::duration_cast<std::chrono::nanoseconds>(clock::now() - begin).count())));
+                }
+            }
+            ops[tid] = done;
+        });
+    }
+
+    auto begin = clock::now();
+    start.store(true, std::memory_order_release);
+    std::this_thread::sleep_for(std::chrono::milliseconds(duration));
+    stop.store(true, std::memory_order_relaxed);
+    for (auto& w : workers) {
+        w.join();
+    }
+
+    result res;
+    res.secs = std::chrono::duration<double>(clock::now() - begin).count();
+    for (int tid = 0; tid < threads; ++tid) {
+        res.ops += ops[tid];
+        res.lat.insert(res.lat.end(), lats[tid].begin(), lats[tid].end());
+    }
+    return res;
+}
+
+inline uint32_t percentile(std::vector<uint32_t>& lat, double pct)
+{
+    if (lat.empty()) {
+        return 0;
+    }
+    size_t idx = std::min(lat.size() - 1, size_t(lat.size() * pct / 100.0));
+    std::nth_element(lat.begin(), lat.begin() + idx, lat.end());
+    return lat[idx];
+}
+
+inline void print_header()
+{
+    std::printf("suite,primitive,threads,read_pct,cs_iters,dist,producers,consumers,ops_per_sec,p50_ns,p99_ns,p999_ns\n");
+}
+
+inline void print(const row& r, result& res)
+{
+    std::printf("%s,%s,%d,%d,%d,%s,%d,%d,%.0f,%u,%u,%u\n",
+                r.suite, r.primitive, r.threads, r.read_pct, r.cs, r.dist, r.producers, r.consumers,
+                res.ops / res.secs, percentile(res.lat, 50), percentile(res.lat, 99), percentile(res.lat, 99.9));
+    std::fflush(stdout);
+}
+
+/* exclusive locking: lock, spin cs iterations, unlock */
+template <typename Lock>
+void bench_lock(const config& cfg, const char* name)
+{
+    for (int threads : cfg.threads) {
+        for (int cs : cfg.cs) {
+            Lock lck;
+            auto res = run(threads, cfg.duration, [&](int, rng_type&) {
+                std::lock_guard<Lock> grd(lck);
+                spin_work(cs);
+                return true;
+            });
+            print(row { "lock", name, threads, 0, cs, "-", 0, 0 }, res);
+        }
+    }
+}
+
+/* shared locking with read_pct readers */
+template <typename Lock>
+void bench_rw(const config& cfg, const char* name)
+{
+    for (int threads : cfg.threads) {
+        for (int reads : cfg.reads) {
+            for (int cs : cfg.cs) {
+                Lock lck;
+                auto res = run(threads, cfg.duration, [&](int, rng_type& rng) {
+                    if (int(rng() % 100) < reads) {
+                        lck.lock_shared();
+                        spin_work(cs);
+                        lck.unlock_shared();
+                    }
+                    else {
+                        lck.lock();
+                        spin_work(cs);
+                        lck.unlock();
+                    }
+                    return true;
+                });
+                print(row { "rw", name, threads, reads, cs, "-", 0, 0 }, res);
+            }
+        }
+    }
+}
+
+/* std reference for safe_queue */
+template <typename T>
+class locked_queue
+{
+public:
+    void push(T t)
+    {
+        std::lock_guard<std::mutex> lck(mtx_);
+        queue_.push_back(std::move(t));
+        cond_.notify_one();
+    }
+
+    bool wait_and_pop(T& val, const std::chrono::milliseconds& timer)
+    {
+        std::unique_lock<std::mutex> lck(mtx_);
+        if (!cond_.wait_for(lck, timer, [this]() { return !queue_.empty(); })) {
+            return false;
+        }
+        val = std::move(queue_.front());
+        queue_.pop_front();
+        return true;
+    }
+
+    size_t size()
+    {
+        std::lock_guard<std::mutex> lck(mtx_);
+        return queue_.size();
+    }
+
+private:
+    std::deque<T>           queue_;
+    std::mutex              mtx_;
+    std::condition_variable cond_;
+};
+
+/* producers:consumers ratios, throughput counts popped items */
+template <typename Queue>
+void bench_queue(const config& cfg, const char* name)
+{
+    static const int ratios[][2] = { { 1, 1 }, { 1, 3 }, { 3, 1 } };
+    const size_t cap = 1 << 16;
+
+    for (int threads : cfg.threads) {
+        if (threads < 2) {
+            continue;
+        }
+
+        for (auto& ratio : ratios) {
+            int producers = std::max(1, std::min(threads - 1, threads * ratio[0] / (ratio[0] + ratio[1])));
+            int consumers = threads - producers;
+            Queue queue;
+            auto res = run(threads, cfg.duration, [&](int tid, rng_type&) {
+                if (tid < producers) {
+                    if (queue.size() >= cap) {
+                        std::this_thread::yield();
+                    }
+                    else {
+                        queue.push(tid);
+                    }
+                    return false;
+                }
+
+                int val;
+                return queue.wait_and_pop(val, std::chrono::milliseconds(1));
+            });
+            print(row { "queue", name, threads, 0, 0, "-", producers, consumers }, res);
+        }
+    }
+}
+
+/* map lookups with read_pct finds, the rest assign */
+template <typename Map>
+struct map_ops;
+
+template <>
+struct map_ops<app::unordered_map<uint64_t, uint64_t>>
+{
+    typedef app::unordered_map<uint64_t, uint64_t> map_type;
+
+    map_type map;
+
+    bool read(uint64_t key)
+    {
+        uint64_t val;
+        return map.find(key, val);
+    }
+
+    void write(uint64_t key, uint64_t val)
+    {
+        auto lck = map.get_lock();
+        map[key] = val;
+    }
+};
+
+/* same map, reads go through a per-thread read_cache */
+struct cached_map
+{
+    app::unordered_map<uint64_t, uint64_t>  map;
+};
+
+template <>
+struct map_ops<cached_map>
+{
+    typedef app::read_cache<app::unordered_map<uint64_t, uint64_t>> cache_type;
+
+    cached_map m;
+    uint64_t id { next_id() };
+
+    static uint64_t next_id()
+    {
+        static std::atomic<uint64_t> ids { 0 };
+        return ++ids;
+    }
+
+    bool read(uint64_t key)
+    {
+        // rebuilt when a thread outlives the map it was bound to
+        static thread_local std::unique_ptr<cache_type> cache;
+        static thread_local uint64_t cache_id = 0;
+        if (cache_id != id) {
+            cache.reset(new cache_type(m.map));
+            cache_id = id;
+        }
+        uint64_t val;
+        return cache->find(key, val);
+    }
+
+    void write(uint64_t key, uint64_t val)
+    {
+        m.map.assign(key, val);
+    }
+};
+
+template <typename Mutex>
+struct std_map
+{
+    std::unordered_map<uint64_t, uint64_t>  map;
+    Mutex                                   mtx;
+};
+
+template <>
+struct map_ops<std_map<std::mutex>>
+{
+    std_map<std::mutex> m;
+
+    bool read(uint64_t key)
+    {
+        std::lock_guard<std::mutex> lck(m.mtx);
+        return m.map.find(key) != m.map.end();
+    }
+
+    void write(uint64_t key, uint64_t val)
+    {
+        std::lock_guard<std::mutex> lck(m.mtx);
+        m.map[key] = val;
+    }
+};
+
+template <>
+struct map_ops<std_map<std::shared_mutex>>
+{
+    std_map<std::shared_mutex> m;
+
+    bool read(uint64_t key)
+    {
+        std::shared_lock<std::shared_mutex> lck(m.mtx);
+        return m.map.find(key) != m.map.end();
+    }
+
+    void write(uint64_t key, uint64_t val)
+    {
+        std::lock_guard<std::shared_mutex> lck(m.mtx);
+        m.map[key] = val;
+    }
+};
+
+template <typename Map>
+void bench_map(const config& cfg, const char* name)
+{
+    zipf_keys uniform(cfg.keys, 0);
+    zipf_keys skewed(cfg.keys, cfg.zipf);
+    const std::pair<const char*, const zipf_keys*> dists[] = { { "uniform", &uniform }, { "zipf", &skewed } };
+
+    for (int threads : cfg.threads) {
+        for (int reads : cfg.reads) {
+            for (auto& dist : dists) {
+                map_ops<Map> ops;
+                for (uint64_t key = 0; key < cfg.keys; ++key) {
+                    ops.write(key, key);
+                }
+
+                const zipf_keys& keys = *dist.second;
+                auto res = run(threads, cfg.duration, [&](int, rng_type& rng) {
+                    uint64_t key = keys(rng);
+                    if (int(rng() % 100) < reads) {
+                        ops.read(key);
+                    }
+                    else {
+                        ops.write(key, rng());
+                    }
+                    return true;
+                });
+                print(row { "map", name, threads, reads, 0, dist.first, 0, 0 }, res);
+            }
+        }
+    }
+}
+
+/* priority queue under contention: every thread pushes then pops, cs iterations outside */
+template <typename Queue>
+struct heap_ops;
+
+template <>
+struct heap_ops<app::safe_priorqueue<int>>
+{
+    app::safe_priorqueue<int> queue;
+
+    void push(int val)
+    {
+        queue.push(val);
+    }
+
+    bool pop()
+    {
+        int val;
+        return queue.try_pop(val);
+    }
+};
+
+template <>
+struct heap_ops<app::flat_combining<std::priority_queue<int>>>
+{
+    app::flat_combining<std::priority_queue<int>> queue;
+
+    void push(int val)
+    {
+        queue.apply([val](std::priority_queue<int>& q) { q.push(val); });
+    }
+
+    bool pop()
+    {
+        return queue.apply([](std::priority_queue<int>& q) {
+            if (q.empty()) {
+                return false;
+            }
+            q.pop();
+            return true;
+        });
+    }
+};
+
+template <typename Queue>
+void bench_combine(const config& cfg, const char* name)
+{
+    for (int threads : cfg.threads) {
+        for (int cs : cfg.cs) {
+            heap_ops<Queue> ops;
+            for (int i = 0; i < 4096; ++i) {
+                ops.push(i);
+            }
+
+            auto res = run(threads, cfg.duration, [&](int, rng_type& rng) {
+                ops.push(int(rng() & 0xffff));
+                spin_work(cs);
+                return ops.pop();
+            });
+            print(row { "combine", name, threads, 0, cs, "-", 0, 0 }, res);
+        }
+    }
+}
+
+/* shared counter increments with cs iterations between them */
+struct atomic_counter
+{
+    std::atomic<int64_t>    value   { 0 };
+
+    void add(int64_t n)
+    {
+        value.fetch_add(n, std::memory_order_relaxed);
+    }
+};
+
+template <typename Counter>
+void bench_counter(const config& cfg, const char* name)
+{
+    for (int threads : cfg.threads) {
+        for (int cs : cfg.cs) {
+            Counter counter;
+            auto res = run(threads, cfg.duration, [&](int, rng_type&) {
+                counter.add(1);
+                spin_work(cs);
+                return true;
+            });
+            print(row { "counter", name, threads, 0, cs, "-", 0, 0 }, res);
+        }
+    }
+}
+
+inline std::vector<std::string> split(const char* arg)
+{
+    std::vector<std::string> out;
+    std::string cur;
+    for (; *arg; ++arg) {
+        if (*arg == ',') {
+            out.push_back(cur);
+            cur.clear();
+        }
+        else {
+            cur += *arg;
+        }
+    }
+    if (!cur.empty()) {
+        out.push_back(cur);
+    }
+    return out;
+}
+
+inline std::vector<int> split_int(const char* arg)
+{
+    std::vector<int> out;
+    for (auto& s : split(arg)) {
+        out.push_back(std::atoi(s.c_str()));
+    }
+    return out;
+}
+
+inline bool parse(int argc, char** argv, config& cfg)
+{
+    for (int i = 1; i < argc; ++i) {
+        const char* arg = argv[i];
+        const char* val = std::strchr(arg, '=');
+        std::string key(arg, val ? val - arg : std::strlen(arg));
+        val = val ? val + 1 : "";
+
+        if (key == "--threads")         cfg.threads = split_int(val);
+        else if (key == "--reads")      cfg.reads = split_int(val);
+        else if (key == "--cs")         cfg.cs = split_int(val);
+        else if (key == "--suite")      cfg.suites = split(val);
+        else if (key == "--duration")   cfg.duration = std::atoi(val);
+        else if (key == "--keys")       cfg.keys = std::strtoull(val, nullptr, 10);
+        else if (key == "--zipf")       cfg.zipf = std::atof(val);
+        else {
+            std::fprintf(stderr, "usage: %s [--threads=1,2,4,8] [--duration=ms] [--suite=lock,rw,queue,map,combine,counter]"
+                                 " [--reads=50,90,99] [--cs=0,64,512] [--keys=n] [--zipf=s]\n", argv[0]);
+            return false;
+        }
+    }
+    return true;
+}
+
+inline bool enabled(const config& cfg, const char* suite)
+{
+    return std::find(cfg.suites.begin(), cfg.suites.end(), suite) != cfg.suites.end();
+}
+
+};
+
+int main(int argc, char** argv)
+{
+    using namespace bench;
+
+    config cfg;
+    if (!parse(argc, argv, cfg)) {
+        return 1;
+    }
+
+    print_header();
+
+    if (enabled(cfg, "lock")) {
+        bench_lock<std::mutex>(cfg, "std::mutex");
+        bench_lock<app::spin_lock>(cfg, "spin_lock");
+        bench_lock<app::spin_mutex>(cfg, "spin_mutex");
+        bench_lock<app::rw_spin_lock>(cfg, "rw_spin_lock");
+        bench_lock<app::shared_mutex>(cfg, "shared_mutex");
+    }
+
+    if (enabled(cfg, "rw")) {
+        bench_rw<std::shared_mutex>(cfg, "std::shared_mutex");
+        bench_rw<app::shared_mutex>(cfg, "shared_mutex");
+        bench_rw<app::reader_prefer_shared_mutex>(cfg, "reader_prefer_shared_mutex");
+        bench_rw<app::phase_fair_shared_mutex>(cfg, "phase_fair_shared_mutex");
+        bench_rw<app::rw_spin_lock>(cfg, "rw_spin_lock");
+    }
+
+    if (enabled(cfg, "queue")) {
+        bench_queue<locked_queue<int>>(cfg, "std::deque+std::mutex");
+        bench_queue<app::safe_queue<int>>(cfg, "safe_queue");
+        bench_queue<app::safe_priorqueue<int>>(cfg, "safe_priorqueue");
+    }
+
+    if (enabled(cfg, "map")) {
+        bench_map<std_map<std::mutex>>(cfg, "std::unordered_map+std::mutex");
+        bench_map<std_map<std::shared_mutex>>(cfg, "std::unordered_map+std::shared_mutex");
+        bench_map<app::unordered_map<uint64_t, uint64_t>>(cfg, "app::unordered_map");
+        bench_map<cached_map>(cfg, "app::unordered_map+read_cache");
+    }
+
+    if (enabled(cfg, "combine")) {
+        bench_combine<app::safe_priorqueue<int>>(cfg, "safe_priorqueue");
+        bench_combine<app::flat_combining<std::priority_queue<int>>>(cfg, "flat_combining");
+    }
+
+    if (enabled(cfg, "counter")) {
+        bench_counter<atomic_counter>(cfg, "std::atomic");
+        bench_counter<app::striped_counter>(cfg, "striped_counter");
+    }
+
+    return 0;
+}
@@ -0,0 +1,255 @@
+#pragma once
+
+#include <mutex>
+#include <atomic>
+#include <memory>
+#include <thread>
+#include <vector>
+#include <cstdint>
+#include <algorithm>
+#include <initializer_list>
+#include <condition_variable>
+
+#include "spinlock.h"
+
+namespace app
+{
+
+enum class wait_strategy
+{
+    busy_spin,      // lowest latency, burns a core per consumer
+    yield,          // spin with pause, then yield
+    block,          // sleep on a condition variable, producers notify
+};
+
+/* disruptor style broadcast ring: one preallocated ring, producers claim sequence
+ * numbers, every consumer sees every event through its own cursor. a consumer may
+ * depend on other consumers and then never passes them. producers gate on the
+ * slowest consumer, so add all consumers before publishing */
+template <typename T>
+class broadcast_ring
+{
+    /* padded so cursors of different consumers do not share a cache line */
+    struct sequence
+    {
+        std::atomic<int64_t>    value   { -1 };
+        char                    pad[64 - sizeof(std::atomic<int64_t>)];
+    };
+
+public:
+    class consumer
+    {
+    public:
+        /* fn(const T&, int64_t seq, bool end_of_batch) for every available event,
+         * the cursor moves once per batch; returns the batch size */
+        template <typename F>
+        size_t poll(F fn)
+        {
+            int64_t next = cursor_.value.load(std::memory_order_relaxed) + 1;
+            int64_t last = ring_.available(next, deps_);
+            if (last < next) {
+                return 0;
+            }
+
+            for (int64_t seq = next; seq <= last; ++seq) {
+                fn(const_cast<const T&>(ring_.slot(seq)), seq, seq == last);
+            }
+            cursor_.value.store(last, std::memory_order_release);
+            ring_.advanced();
+            return size_t(last - next + 1);
+        }
+
+        /* waits with the ring's strategy until at least one event is available */
+        template <typename F>
+        size_t wait_and_poll(F fn)
+        {
+            for (spin_backoff backoff;;) {
+                size_t n = poll(fn);
+                if (n != 0) {
+                    return n;
+                }
+                ring_.wait(backoff, [this]() {
+                    int64_t next = cursor_.value.load(std::memory_order_relaxed) + 1;
+                    return ring_.available(next, deps_) >= next;
+                });
+            }
+        }
+
+        int64_t cursor() const
+        {
+            return cursor_.value.load(std::memory_order_acquire);
+        }
+
+    private:
+        friend class broadcast_ring;
+
+        consumer(broadcast_ring& ring, std::vector<const consumer*> deps)
+            : ring_(ring), deps_(std::move(deps))
+        {
+        }
+
+        consumer(const consumer&) = delete;
+        consumer& operator=(const consumer&) = delete;
+
+    private:
+        broadcast_ring&                 ring_;
+        std::vector<const consumer*>    deps_;
+        sequence                        cursor_;
+    };
+
+public:
+    /* capacity is rounded up to a power of two */
+    explicit broadcast_ring(size_t capacity, wait_strategy strategy = wait_strategy::yield)
+        : strategy_(strategy)
+    {
+        size_t cap = 1;
+        for (; cap < capacity; cap <<= 1);
+        mask_ = cap - 1;
+        slots_.resize(cap);
+        published_.reset(new std::atomic<int64_t>[cap]);
+        for (size_t i = 0; i < cap; ++i) {
+            published_[i].store(-1, std::memory_order_relaxed);
+        }
+    }
+
+    ~broadcast_ring() = default;
+
+    consumer& add_consumer(std::initializer_list<const consumer*> deps = {})
+    {
+        consumers_.emplace_back(new consumer(*this, std::vector<const consumer*>(deps)));
+        return *consumers_.back();
+    }
+
+    /* claims n consecutive sequences, returns the first; waits while the ring is full */
+    int64_t claim(size_t n = 1)
+    {
+        int64_t first = claim_.value.fetch_add(int64_t(n), std::memory_order_relaxed) + 1;
+        int64_t wrap = first + int64_t(n) - 1 - int64_t(mask_ + 1);
+
+        for (spin_backoff backoff; wrap > gating_.load(std::memory_order_acquire);) {
+            int64_t slowest = min_cursor();
+            gating_.store(slowest, std::memory_order_release);
+            if (wrap > slowest) {
+                backoff.pause();
+            }
+        }
+        return first;
+    }
+
+    T& operator[](int64_t seq)
+    {
+        return slot(seq);
+    }
+
+    void publish(int64_t seq)
+    {
+        published_[seq & mask_].store(seq, std::memory_order_release);
+        signal();
+    }
+
+    void publish(int64_t first, int64_t last)
+    {
+        for (int64_t seq = first; seq <= last; ++seq) {
+            published_[seq & mask_].store(seq, std::memory_order_release);
+        }
+        signal();
+    }
+
+    void push(T t)
+    {
+        int64_t seq = claim();
+        slot(seq) = std::move(t);
+        publish(seq);
+    }
+
+    size_t capacity() const
+    {
+        return mask_ + 1;
+    }
+
+private:
+    T& slot(int64_t seq)
+    {
+        return slots_[size_t(seq) & mask_];
+    }
+
+    /* highest sequence >= next that is published and not beyond any dependency, or next - 1 */
+    int64_t available(int64_t next, const std::vector<const consumer*>& deps) const
+    {
+        int64_t limit = INT64_MAX;
+        for (auto dep : deps) {
+            limit = std::min(limit, dep->cursor());
+        }
+
+        int64_t seq = next;
+        for (; seq <= limit && published_[seq & mask_].load(std::memory_order_acquire) == seq; ++seq);
+        return seq - 1;
+    }
+
+    int64_t min_cursor() const
+    {
+        int64_t slowest = claim_.value.load(std::memory_order_relaxed);
+        for (auto& c : consumers_) {
+            slowest = std::min(slowest, c->cursor());
+        }
+        return slowest;
+    }
+
+    template <typename Ready>
+    void wait(spin_backoff& backoff, Ready ready)
+    {
+        switch (strategy_) {
+        case wait_strategy::busy_spin:
+            cpu_relax();
+            break;
+        case wait_strategy::yield:
+            backoff.pause();
+            break;
+        case wait_strategy::block: {
+            std::unique_lock<std::mutex> lck(mtx_);
+            ++waiters_;
+            cond_.wait(lck, ready);
+            --waiters_;
+            break;
+        }
+        }
+    }
+
+    /* wakes blocked consumers on publish and dependents on cursor moves */
+    void signal()
+    {
+        if (strategy_ != wait_strategy::block) {
+            return;
+        }
+
+        // pairs with the waiters_ increment before the predicate check in wait()
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+        if (waiters_.load(std::memory_order_relaxed) > 0) {
+            std::lock_guard<std::mutex> lck(mtx_);
+            cond_.notify_all();
+        }
+    }
+
+    void advanced()
+    {
+        signal();
+    }
+
+private:
+    broadcast_ring(const broadcast_ring&) = delete;
+    broadcast_ring& operator=(const broadcast_ring&) = delete;
+
+private:
+    wait_strategy                               strategy_;
+    size_t                                      mask_;
+    std::vector<T>                              slots_;
+    std::unique_ptr<std::atomic<int64_t>[]>     published_;
+    std::vector<std::unique_ptr<consumer>>      consumers_;
+    sequence                                    claim_;
+    std::atomic<int64_t>                        gating_     { -1 };
+    std::mutex                                  mtx_;
+    std::condition_variable                     cond_;
+    std::atomic<size_t>                         waiters_    { 0 };
+};
+
+};
@@ -0,0 +1,209 @@
+#pragma once
+
+#include <atomic>
+#include <thread>
+#include <cstdint>
+#include <utility>
+#include <exception>
+
+#include "spinlock.h"
+
+namespace app
+{
+
+/* flat combining around a sequential structure: a caller publishes its operation in
+ * a padded slot, whoever wins the combiner flag runs every published operation in one
+ * pass while DS stays in its cache, the others spin on their own slot.
+ *   app::flat_combining<std::priority_queue<int>> pq;
+ *   pq.apply([](std::priority_queue<int>& q) { q.push(1); });
+ * a thread holds a slot only for the duration of one apply, Slots bounds how many
+ * operations can be published at once, not how many threads may use the wrapper */
+template <typename DS, size_t Slots = 64>
+class flat_combining
+{
+    enum { slot_free, slot_claimed, slot_pending, slot_done };
+
+    /* one cache line each, aligned so neighbouring slots never share a line */
+    struct alignas(64) slot
+    {
+        std::atomic<int>    state   { slot_free };
+        void              (*call)(void*, DS&);
+        void*               ctx;
+    };
+
+    /* holds the operation and its result on the caller's stack, R must be default constructible */
+    template <typename F, typename R>
+    struct op
+    {
+        explicit op(F& f)
+            : fn(f), result()
+        {
+        }
+
+        static void invoke(void* ctx, DS& ds)
+        {
+            op* self = static_cast<op*>(ctx);
+            try {
+                self->result = self->fn(ds);
+            }
+            catch (...) {
+                self->error = std::current_exception();
+            }
+        }
+
+        R get()
+        {
+            if (error) {
+                std::rethrow_exception(error);
+            }
+            return std::move(result);
+        }
+
+        F&                  fn;
+        R                   result;
+        std::exception_ptr  error;
+    };
+
+    template <typename F>
+    struct op<F, void>
+    {
+        explicit op(F& f)
+            : fn(f)
+        {
+        }
+
+        static void invoke(void* ctx, DS& ds)
+        {
+            op* self = static_cast<op*>(ctx);
+            try {
+                self->fn(ds);
+            }
+            catch (...) {
+                self->error = std::current_exception();
+            }
+        }
+
+        void get()
+        {
+            if (error) {
+                std::rethrow_exception(error);
+            }
+        }
+
+        F&                  fn;
+        std::exception_ptr  error;
+    };
+
+public:
+    template <typename... Args>
+    explicit flat_combining(Args&&... args)
+        : ds_(std::forward<Args>(args)...)
+    {
+    }
+
+    ~flat_combining() = default;
+
+    /* runs fn(DS&) under mutual exclusion with every other apply and returns its result;
+     * fn may run on another thread, an exception it throws is rethrown here */
+    template <typename F>
+    auto apply(F fn) -> decltype(fn(std::declval<DS&>()))
+    {
+        typedef decltype(fn(std::declval<DS&>())) result_type;
+        op<F, result_type> o(fn);
+        slot& s = claim();
+        s.call = &op<F, result_type>::invoke;
+        s.ctx = &o;
+        s.state.store(slot_pending, std::memory_order_release);
+
+        for (spin_backoff backoff; s.state.load(std::memory_order_acquire) != slot_done;) {
+            if (!busy_.load(std::memory_order_relaxed) && !busy_.exchange(true, std::memory_order_acquire)) {
+                combine();
+                busy_.store(false, std::memory_order_release);
+                continue;
+            }
+            backoff.pause();
+        }
+
+        s.state.store(slot_free, std::memory_order_release);
+        return o.get();
+    }
+
+    /* operations run so far and combining passes that ran them, ops / passes is the mean batch */
+    uint64_t operations() const
+    {
+        return ops_.load(std::memory_order_relaxed);
+    }
+
+    uint64_t passes() const
+    {
+        return passes_.load(std::memory_order_relaxed);
+    }
+
+    /* direct access, only while no other thread calls apply */
+    DS& unsafe()
+    {
+        return ds_;
+    }
+
+private:
+    /* starts at a per-thread home slot so threads rarely collide on the claim */
+    slot& claim()
+    {
+        static std::atomic<size_t> next { 0 };
+        static thread_local size_t home = next.fetch_add(1, std::memory_order_relaxed);
+
+        for (size_t i = home;; ++i) {
+            slot& s = slots_[i % Slots];
+            int expect = slot_free;
+            if (s.state.load(std::memory_order_relaxed) == slot_free
+                && s.state.compare_exchange_strong(expect, slot_claimed, std::memory_order_acquire, std::memory_order_relaxed)) {
+                size_t used = used_.load(std::memory_order_relaxed);
+                while (i % Slots >= used && !used_.compare_exchange_weak(used, i % Slots + 1, std::memory_order_relaxed));
+                return s;
+            }
+            if (i - home + 1 == Slots) {
+                std::this_thread::yield();
+            }
+        }
+    }
+
+    /* combiner only; scans up to the highest slot ever claimed,
+     * a second scan picks up operations published during the first */
+    void combine()
+    {
+        uint64_t ran = 0;
+        for (int pass = 0; pass < 2; ++pass) {
+            uint64_t before = ran;
+            size_t used = used_.load(std::memory_order_relaxed);
+            for (size_t i = 0; i < used; ++i) {
+                slot& s = slots_[i];
+                if (s.state.load(std::memory_order_acquire) == slot_pending) {
+                    s.call(s.ctx, ds_);
+                    s.state.store(slot_done, std::memory_order_release);
+                    ++ran;
+                }
+            }
+            if (ran == before) {
+                break;
+            }
+        }
+
+        ops_.store(ops_.load(std::memory_order_relaxed) + ran, std::memory_order_relaxed);
+        passes_.store(passes_.load(std::memory_order_relaxed) + 1, std::memory_order_relaxed);
+    }
+
+private:
+    flat_combining(const flat_combining&) = delete;
+    flat_combining& operator=(const flat_combining&) = delete;
+
+private:
+    std::atomic<bool>       busy_       { false };
+    char                    pad_[64 - sizeof(std::atomic<bool>)];
+    slot                    slots_[Slots];
+    std::atomic<size_t>     used_       { 0 };
+    DS                      ds_;
+    std::atomic<uint64_t>   ops_        { 0 };
+    std::atomic<uint64_t>   passes_     { 0 };
+};
+
+};
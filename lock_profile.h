@@ -0,0 +1,469 @@
+#pragma once
+
+#include <mutex>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <string>
+#include <vector>
+#include <thread>
+#include <ostream>
+#include <algorithm>
+#include <functional>
+#include <condition_variable>
+
+/* lock contention profiling, compiled in with -DAPP_LOCK_PROFILE.
+ * without it profiled_lock<L> adds nothing to L and profiled_mutex is std::mutex */
+
+namespace app
+{
+
+/* log2 buckets of nanoseconds */
+class lock_histogram
+{
+public:
+    enum { buckets = 40 };
+
+    lock_histogram()
+    {
+        for (auto& cnt : cnt_) {
+            cnt.store(0, std::memory_order_relaxed);
+        }
+    }
+
+    void record(uint64_t ns)
+    {
+        size_t idx = 0;
+        for (; (ns >> idx) > 1 && idx + 1 < buckets; ++idx);
+        cnt_[idx].fetch_add(1, std::memory_order_relaxed);
+
+        uint64_t max = max_.load(std::memory_order_relaxed);
+        while (ns > max && !max_.compare_exchange_weak(max, ns, std::memory_order_relaxed));
+    }
+
+    /* upper bound of the bucket holding the pct quantile, pct in [0, 100] */
+    uint64_t percentile(double pct) const
+    {
+        uint64_t total = 0;
+        for (auto& cnt : cnt_) {
+            total += cnt.load(std::memory_order_relaxed);
+        }
+        if (total == 0) {
+            return 0;
+        }
+
+        uint64_t rank = static_cast<uint64_t>(total * pct / 100.0);
+        uint64_t seen = 0;
+        for (size_t idx = 0; idx < buckets; ++idx) {
+            seen += cnt_[idx].load(std::memory_order_relaxed);
+            if (seen > rank) {
+                return std::min<uint64_t>(uint64_t(2) << idx, max());
+            }
+        }
+        return max();
+    }
+
+    uint64_t max() const
+    {
+        return max_.load(std::memory_order_relaxed);
+    }
+
+    /* fold another histogram in, used to aggregate per-thread histograms */
+    void merge(const lock_histogram& other)
+    {
+        for (size_t idx = 0; idx < buckets; ++idx) {
+            cnt_[idx].fetch_add(other.cnt_[idx].load(std::memory_order_relaxed), std::memory_order_relaxed);
+        }
+
+        uint64_t ns = other.max();
+        uint64_t max = max_.load(std::memory_order_relaxed);
+        while (ns > max && !max_.compare_exchange_weak(max, ns, std::memory_order_relaxed));
+    }
+
+private:
+    std::atomic<uint64_t>   cnt_[buckets];
+    std::atomic<uint64_t>   max_    { 0 };
+};
+
+
+class lock_stats;
+
+/* process wide list of named locks and queues, dumped as text or json */
+class lock_registry
+{
+public:
+    static lock_registry& instance()
+    {
+        static lock_registry registry;
+        return registry;
+    }
+
+    /* sample one acquisition out of rate per thread, 0 disables timing */
+    void sample_rate(unsigned rate)
+    {
+        rate_.store(rate, std::memory_order_relaxed);
+    }
+
+    unsigned sample_rate() const
+    {
+        return rate_.load(std::memory_order_relaxed);
+    }
+
+    void add(lock_stats* stats)
+    {
+        std::lock_guard<std::mutex> lck(mtx_);
+        stats_.push_back(stats);
+    }
+
+    void remove(lock_stats* stats)
+    {
+        std::lock_guard<std::mutex> lck(mtx_);
+        stats_.erase(std::remove(stats_.begin(), stats_.end(), stats), stats_.end());
+    }
+
+    inline void dump_text(std::ostream& os) const;
+    inline void dump_json(std::ostream& os) const;
+
+private:
+    lock_registry() = default;
+    lock_registry(const lock_registry&) = delete;
+    lock_registry& operator=(const lock_registry&) = delete;
+
+private:
+    mutable std::mutex          mtx_;
+    std::vector<lock_stats*>    stats_;
+    std::atomic<unsigned>       rate_   { 64 };
+};
+
+
+class alignas(64) lock_stats
+{
+public:
+    typedef std::chrono::steady_clock   clock;
+
+    explicit lock_stats(const char* name)
+        : name_(name)
+    {
+        lock_registry::instance().add(this);
+    }
+
+    ~lock_stats()
+    {
+        lock_registry::instance().remove(this);
+    }
+
+    static bool sampled()
+    {
+        static thread_local unsigned tick = 0;
+        unsigned rate = lock_registry::instance().sample_rate();
+        return rate != 0 && ++tick % rate == 0;
+    }
+
+    static uint64_t since(clock::time_point start)
+    {
+        return std::chrono::duration_cast<std::chrono::nanoseconds>(clock::now() - start).count();
+    }
+
+    /* counted on every acquisition, only the timings are sampled */
+    void acquired(bool contended = false)
+    {
+        acquisitions_.fetch_add(1, std::memory_order_relaxed);
+        if (contended) {
+            contended_.fetch_add(1, std::memory_order_relaxed);
+        }
+    }
+
+    void waited(uint64_t ns)
+    {
+        wait_.record(ns);
+    }
+
+    void held(uint64_t ns)
+    {
+        uint64_t longest = hold_.max();
+        hold_.record(ns);
+        if (ns > longest) {
+            longest_holder_.store(std::hash<std::thread::id>()(std::this_thread::get_id()), std::memory_order_relaxed);
+        }
+    }
+
+    /* not synchronized with dumps, call before the lock is shared */
+    void rename(const char* name)
+    {
+        name_ = name;
+    }
+
+    const std::string& name() const { return name_; }
+    uint64_t acquisitions() const { return acquisitions_.load(std::memory_order_relaxed); }
+    uint64_t contended() const { return contended_.load(std::memory_order_relaxed); }
+    size_t longest_holder() const { return longest_holder_.load(std::memory_order_relaxed); }
+    const lock_histogram& wait_histogram() const { return wait_; }
+    const lock_histogram& hold_histogram() const { return hold_; }
+
+private:
+    lock_stats(const lock_stats&) = delete;
+    lock_stats& operator=(const lock_stats&) = delete;
+
+private:
+    std::string             name_;
+    std::atomic<uint64_t>   acquisitions_   { 0 };
+    std::atomic<uint64_t>   contended_      { 0 };
+    std::atomic<size_t>     longest_holder_ { 0 };
+    lock_histogram          wait_;
+    lock_histogram          hold_;
+};
+
+inline void lock_registry::dump_text(std::ostream& os) const
+{
+    std::lock_guard<std::mutex> lck(mtx_);
+    os << "name acquisitions contended wait_p50_ns wait_p99_ns wait_max_ns hold_p50_ns hold_p99_ns hold_max_ns longest_holder\n";
+    for (auto stats : stats_) {
+        auto& wait = stats->wait_histogram();
+        auto& hold = stats->hold_histogram();
+        os << stats->name() << ' ' << stats->acquisitions() << ' ' << stats->contended() << ' '
+           << wait.percentile(50) << ' ' << wait.percentile(99) << ' ' << wait.max() << ' '
+           << hold.percentile(50) << ' ' << hold.percentile(99) << ' ' << hold.max() << ' '
+           << stats->longest_holder() << '\n';
+    }
+}
+
+inline void json_escape(std::ostream& os, const std::string& str)
+{
+    static const char hex[] = "0123456789abcdef";
+    for (char c : str) {
+        if (c == '"' || c == '\\') {
+            os << '\\' << c;
+        }
+        else if (static_cast<unsigned char>(c) < 0x20) {
+            os << "\\u00" << hex[(c >> 4) & 0xf] << hex[c & 0xf];
+        }
+        else {
+            os << c;
+        }
+    }
+}
+
+inline void lock_registry::dump_json(std::ostream& os) const
+{
+    std::lock_guard<std::mutex> lck(mtx_);
+    os << '[';
+    for (size_t i = 0; i < stats_.size(); ++i) {
+        auto stats = stats_[i];
+        auto& wait = stats->wait_histogram();
+        auto& hold = stats->hold_histogram();
+        os << (i ? "," : "") << "{\"name\":\"";
+        json_escape(os, stats->name());
+        os << '"'
+           << ",\"acquisitions\":" << stats->acquisitions()
+           << ",\"contended\":" << stats->contended()
+           << ",\"wait_ns\":{\"p50\":" << wait.percentile(50) << ",\"p99\":" << wait.percentile(99) << ",\"max\":" << wait.max() << '}'
+           << ",\"hold_ns\":{\"p50\":" << hold.percentile(50) << ",\"p99\":" << hold.percentile(99) << ",\"max\":" << hold.max() << '}'
+           << ",\"longest_holder\":" << stats->longest_holder() << '}';
+    }
+    os << "]\n";
+}
+
+
+/* always-on contention counters: the uncontended path is one try_lock,
+ * counters are only written while the lock is held so they need no atomics;
+ * read them while holding the lock */
+template <typename Lock>
+class counted_lock : public Lock
+{
+public:
+    counted_lock() = default;
+
+    void lock()
+    {
+        if (Lock::try_lock()) {
+            ++acquisitions_;
+            return;
+        }
+
+        auto start = lock_stats::clock::now();
+        Lock::lock();
+        uint64_t ns = lock_stats::since(start);
+        ++acquisitions_;
+        ++contended_;
+        wait_ns_ += ns;
+        wait_max_ns_ = std::max(wait_max_ns_, ns);
+    }
+
+    bool try_lock()
+    {
+        if (!Lock::try_lock()) {
+            return false;
+        }
+        ++acquisitions_;
+        return true;
+    }
+
+    uint64_t acquisitions() const { return acquisitions_; }
+    uint64_t contended() const { return contended_; }
+    uint64_t wait_ns() const { return wait_ns_; }
+    uint64_t wait_max_ns() const { return wait_max_ns_; }
+
+private:
+    counted_lock(const counted_lock&) = delete;
+    counted_lock& operator=(const counted_lock&) = delete;
+
+private:
+    uint64_t    acquisitions_   { 0 };
+    uint64_t    contended_      { 0 };
+    uint64_t    wait_ns_        { 0 };
+    uint64_t    wait_max_ns_    { 0 };
+};
+
+
+#ifdef APP_LOCK_PROFILE
+
+/* named wrapper around any lockable: spin_lock, spin_mutex, shared_mutex, std::mutex */
+template <typename Lock>
+class profiled_lock : public Lock
+{
+public:
+    explicit profiled_lock(const char* name = "anonymous")
+        : stats_(name)
+    {
+    }
+
+    /* the try_lock runs every time so contended counts every acquisition,
+     * the clock is read only on sampled ones */
+    void lock()
+    {
+        bool sampled = lock_stats::sampled();
+        auto start = sampled ? lock_stats::clock::now() : lock_stats::clock::time_point();
+        bool contended = !Lock::try_lock();
+        if (contended) {
+            Lock::lock();
+        }
+        stats_.acquired(contended);
+        if (sampled) {
+            stats_.waited(lock_stats::since(start));
+            hold_start_ = lock_stats::clock::now();
+        }
+    }
+
+    bool try_lock()
+    {
+        if (!Lock::try_lock()) {
+            return false;
+        }
+        stats_.acquired();
+        return true;
+    }
+
+    void unlock()
+    {
+        if (hold_start_ != lock_stats::clock::time_point()) {
+            stats_.held(lock_stats::since(hold_start_));
+            hold_start_ = lock_stats::clock::time_point();
+        }
+        Lock::unlock();
+    }
+
+    /* readers hold the lock together, a sampled reader keeps its hold start per thread */
+    void lock_shared()
+    {
+        bool sampled = lock_stats::sampled();
+        auto start = sampled ? lock_stats::clock::now() : lock_stats::clock::time_point();
+        bool contended = !Lock::try_lock_shared();
+        if (contended) {
+            Lock::lock_shared();
+        }
+        stats_.acquired(contended);
+        if (sampled) {
+            stats_.waited(lock_stats::since(start));
+            auto& starts = shared_starts();
+            if (starts.size() == max_shared_starts) {
+                starts.erase(starts.begin());
+            }
+            starts.emplace_back(this, lock_stats::clock::now());
+        }
+    }
+
+    bool try_lock_shared()
+    {
+        if (!Lock::try_lock_shared()) {
+            return false;
+        }
+        stats_.acquired();
+        return true;
+    }
+
+    void unlock_shared()
+    {
+        auto& starts = shared_starts();
+        for (size_t i = starts.size(); i-- > 0; ) {
+            if (starts[i].first == this) {
+                stats_.held(lock_stats::since(starts[i].second));
+                starts.erase(starts.begin() + i);
+                break;
+            }
+        }
+        Lock::unlock_shared();
+    }
+
+    const lock_stats& stats() const
+    {
+        return stats_;
+    }
+
+    lock_stats& stats()
+    {
+        return stats_;
+    }
+
+private:
+    typedef std::vector<std::pair<const void*, lock_stats::clock::time_point> > start_list;
+
+    /* a reader released on another thread leaves its entry behind, the list is capped */
+    enum { max_shared_starts = 16 };
+
+    static start_list& shared_starts()
+    {
+        static thread_local start_list starts;
+        return starts;
+    }
+
+private:
+    lock_stats                      stats_;
+    lock_stats::clock::time_point   hold_start_;
+};
+
+template <typename Lock>
+inline void lock_profile_name(profiled_lock<Lock>& lck, const char* name)
+{
+    lck.stats().rename(name);
+}
+
+template <typename Lock>
+inline void lock_profile_name(Lock&, const char*)
+{
+}
+
+typedef profiled_lock<std::mutex>       profiled_mutex;
+typedef std::condition_variable_any     profiled_condition_variable;
+
+#else
+
+template <typename Lock>
+class profiled_lock : public Lock
+{
+public:
+    explicit profiled_lock(const char* = "anonymous")
+    {
+    }
+};
+
+template <typename Lock>
+inline void lock_profile_name(Lock&, const char*)
+{
+}
+
+typedef std::mutex                      profiled_mutex;
+typedef std::condition_variable         profiled_condition_variable;
+
+#endif
+
+};
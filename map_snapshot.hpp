@@ -0,0 +1,283 @@
+#pragma once
+
+#include <thread>
+#include <vector>
+#include <string>
+#include <cstdio>
+#include <cstdint>
+#include <cstring>
+#include <algorithm>
+#include <functional>
+#include <type_traits>
+
+#include "mapped_file.hpp"
+#include "unordered_map.hpp"
+
+/* snapshot files for app::unordered_map with trivially copyable keys and values.
+ * layout: header | bucket offsets (buckets + 1 x uint64) | records grouped by bucket.
+ * the records are bucketed with the map's hasher, mixed so that identity hashes of
+ * strided integer keys still spread, so a snapshot can be queried in place through
+ * map_snapshot without building anything; the hasher must give the same value for a
+ * key in every process (std::hash of integers does) */
+
+namespace app
+{
+
+struct snapshot_header
+{
+    char        magic[8];           // "APPMAPS2"
+    uint32_t    key_size;
+    uint32_t    value_size;
+    uint32_t    record_size;
+    uint32_t    record_align;
+    uint64_t    count;
+    uint64_t    buckets;            // power of two
+    uint64_t    offsets_pos;
+    uint64_t    records_pos;
+    uint64_t    file_size;
+};
+
+template <typename K, typename V>
+struct snapshot_record
+{
+    K   key;
+    V   value;
+};
+
+/* about one record per bucket */
+inline uint64_t snapshot_buckets(uint64_t count)
+{
+    uint64_t n = 1;
+    for (; n < count; n <<= 1);
+    return n;
+}
+
+/* 64 - log2(buckets), buckets is a power of two */
+inline unsigned snapshot_shift(uint64_t buckets)
+{
+    unsigned shift = 64;
+    for (; buckets > 1; buckets >>= 1, --shift);
+    return shift;
+}
+
+/* golden ratio multiply, the high bits pick the bucket */
+inline uint64_t snapshot_bucket(size_t hash, unsigned shift)
+{
+    return shift >= 64 ? 0 : (uint64_t(hash) * 0x9e3779b97f4a7c15ull) >> shift;
+}
+
+
+/* read only view of a snapshot file, usable as soon as open() returns */
+template <typename K, typename V, typename Hash = std::hash<K>, typename Pred = std::equal_to<K> >
+class map_snapshot
+{
+public:
+    typedef snapshot_record<K, V>   record;
+
+    static_assert(std::is_trivially_copyable<K>::value && std::is_trivially_copyable<V>::value,
+                  "map_snapshot needs trivially copyable keys and values");
+
+    explicit map_snapshot(const Hash& hf = Hash(), const Pred& eql = Pred())
+        : hf_(hf), eql_(eql)
+    {
+    }
+
+    ~map_snapshot() = default;
+
+    /* false if the file is missing, truncated, corrupt, or written for other key or
+     * value types. the whole offset table is checked here, find() trusts it */
+    bool open(const std::string& path)
+    {
+        header_ = nullptr;
+        if (!file_.open(path) || file_.size() < sizeof(snapshot_header)) {
+            return false;
+        }
+
+        // sizes are compared by division, a hostile header cannot overflow them
+        uint64_t size = file_.size();
+        auto h = reinterpret_cast<const snapshot_header*>(file_.data());
+        if (std::memcmp(h->magic, "APPMAPS2", 8) != 0
+            || h->key_size != sizeof(K) || h->value_size != sizeof(V)
+            || h->record_size != sizeof(record) || h->record_align != alignof(record)
+            || h->file_size != size
+            || h->buckets == 0 || (h->buckets & (h->buckets - 1)) != 0
+            || h->offsets_pos > size || h->offsets_pos % alignof(uint64_t) != 0
+            || h->buckets >= (size - h->offsets_pos) / sizeof(uint64_t)
+            || h->records_pos < h->offsets_pos + (h->buckets + 1) * sizeof(uint64_t)
+            || h->records_pos > size || h->records_pos % alignof(record) != 0
+            || h->count > (size - h->records_pos) / sizeof(record)) {
+            file_.close();
+            return false;
+        }
+
+        offsets_ = reinterpret_cast<const uint64_t*>(file_.data() + h->offsets_pos);
+        records_ = reinterpret_cast<const record*>(file_.data() + h->records_pos);
+        uint64_t prev = 0;
+        for (uint64_t b = 0; b <= h->buckets; ++b) {
+            if (offsets_[b] < prev) {
+                file_.close();
+                return false;
+            }
+            prev = offsets_[b];
+        }
+        if (offsets_[0] != 0 || prev != h->count) {
+            file_.close();
+            return false;
+        }
+
+        header_ = h;
+        shift_ = snapshot_shift(h->buckets);
+        file_.advise(mapped_file::random);
+        return true;
+    }
+
+    void close()
+    {
+        header_ = nullptr;
+        file_.close();
+    }
+
+    bool is_open() const
+    {
+        return header_ != nullptr;
+    }
+
+    size_t size() const
+    {
+        return header_ ? size_t(header_->count) : 0;
+    }
+
+    const V* find(const K& key) const
+    {
+        if (header_ == nullptr) {
+            return nullptr;
+        }
+
+        uint64_t b = snapshot_bucket(hf_(key), shift_);
+        for (uint64_t i = offsets_[b]; i < offsets_[b + 1]; ++i) {
+            if (eql_(records_[i].key, key)) {
+                return &records_[i].value;
+            }
+        }
+        return nullptr;
+    }
+
+    bool find(const K& key, V& value) const
+    {
+        const V* found = find(key);
+        if (found) {
+            value = *found;
+        }
+        return found != nullptr;
+    }
+
+    size_t count(const K& key) const
+    {
+        return find(key) ? 1 : 0;
+    }
+
+    /* records in file order, grouped by bucket */
+    const record* begin() const
+    {
+        return records_;
+    }
+
+    const record* end() const
+    {
+        return records_ + size();
+    }
+
+    /* copies the snapshot into map through parallel_build, keys already in map keep
+     * their value. returns the number of records inserted */
+    template <typename A>
+    size_t load_into(unordered_map<K, V, Hash, Pred, A>& map,
+                     size_t nthreads = std::thread::hardware_concurrency()) const
+    {
+        size_t n = size();
+        if (n == 0) {
+            return 0;
+        }
+        file_.advise(mapped_file::willneed, size_t(header_->records_pos), n * sizeof(record));
+        return map.parallel_build(begin(), end(), nthreads, [](const record& r) {
+            return std::make_pair(r.key, r.value);
+        });
+    }
+
+private:
+    map_snapshot(const map_snapshot&) = delete;
+    map_snapshot& operator=(const map_snapshot&) = delete;
+
+private:
+    Hash                        hf_;
+    Pred                        eql_;
+    mutable mapped_file         file_;
+    const snapshot_header*      header_     { nullptr };
+    const uint64_t*             offsets_    { nullptr };
+    const record*               records_    { nullptr };
+    unsigned                    shift_      { 64 };
+};
+
+
+/* writes map to path through a temporary file renamed into place once it is synced,
+ * so a crash never leaves a torn snapshot. the map is locked while it is copied out */
+template <typename K, typename V, typename Hash, typename Pred, typename A>
+bool write_snapshot(const unordered_map<K, V, Hash, Pred, A>& map, const std::string& path)
+{
+    typedef snapshot_record<K, V> record;
+
+    static_assert(std::is_trivially_copyable<K>::value && std::is_trivially_copyable<V>::value,
+                  "write_snapshot needs trivially copyable keys and values");
+
+    auto lck = map.get_lock();
+    uint64_t count = map.size();
+    uint64_t buckets = snapshot_buckets(count);
+    unsigned shift = snapshot_shift(buckets);
+    Hash hf = map.hash_function();
+
+    std::vector<uint64_t> offsets(buckets + 1, 0);
+    for (auto& kv : map) {
+        ++offsets[snapshot_bucket(hf(kv.first), shift) + 1];
+    }
+    for (uint64_t b = 0; b < buckets; ++b) {
+        offsets[b + 1] += offsets[b];
+    }
+
+    snapshot_header h;
+    std::memset(&h, 0, sizeof(h));
+    std::memcpy(h.magic, "APPMAPS2", 8);
+    h.key_size = sizeof(K);
+    h.value_size = sizeof(V);
+    h.record_size = sizeof(record);
+    h.record_align = alignof(record);
+    h.count = count;
+    h.buckets = buckets;
+    h.offsets_pos = (sizeof(snapshot_header) + 63) / 64 * 64;
+    h.records_pos = (h.offsets_pos + (buckets + 1) * sizeof(uint64_t) + 63) / 64 * 64;
+    h.file_size = h.records_pos + count * sizeof(record);
+
+    std::string tmp = path + ".tmp";
+    mapped_file file;
+    if (!file.create(tmp, size_t(h.file_size))) {
+        return false;
+    }
+
+    std::memcpy(file.data(), &h, sizeof(h));
+    std::memcpy(file.data() + h.offsets_pos, offsets.data(), offsets.size() * sizeof(uint64_t));
+    record* records = reinterpret_cast<record*>(file.data() + h.records_pos);
+    for (auto& kv : map) {
+        record& r = records[offsets[snapshot_bucket(hf(kv.first), shift)]++];
+        r.key = kv.first;
+        r.value = kv.second;
+    }
+    lck.unlock();
+
+    bool ok = file.sync();
+    file.close();
+    if (!ok || std::rename(tmp.c_str(), path.c_str()) != 0) {
+        std::remove(tmp.c_str());
+        return false;
+    }
+    return true;
+}
+
+};
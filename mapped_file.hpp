@@ -0,0 +1,205 @@
+#pragma once
+
+#include <string>
+#include <vector>
+#include <cstdio>
+#include <cstddef>
+#include <algorithm>
+
+#if defined(__unix__) || defined(__APPLE__)
+#   define APP_HAS_MMAP 1
+#   include <fcntl.h>
+#   include <unistd.h>
+#   include <sys/mman.h>
+#   include <sys/stat.h>
+#endif
+
+namespace app
+{
+
+/* whole file memory mapping: open() maps an existing file, create() makes a file
+ * of a fixed size mapped read write. without mmap the file is read into or
+ * written from a heap buffer, so callers work the same, only slower */
+class mapped_file
+{
+public:
+    enum advice { normal, sequential, random, willneed };
+
+    mapped_file() = default;
+
+    ~mapped_file()
+    {
+        close();
+    }
+
+    /* maps an existing file, read write when writable */
+    bool open(const std::string& path, bool writable = false)
+    {
+        close();
+        path_ = path;
+#ifdef APP_HAS_MMAP
+        int fd = ::open(path.c_str(), writable ? O_RDWR : O_RDONLY);
+        if (fd < 0) {
+            return false;
+        }
+
+        struct stat st;
+        if (::fstat(fd, &st) != 0 || st.st_size == 0) {
+            ::close(fd);
+            return false;
+        }
+
+        int prot = writable ? PROT_READ | PROT_WRITE : PROT_READ;
+        void* addr = ::mmap(nullptr, size_t(st.st_size), prot, MAP_SHARED, fd, 0);
+        ::close(fd);
+        if (addr == MAP_FAILED) {
+            return false;
+        }
+        data_ = static_cast<char*>(addr);
+        size_ = size_t(st.st_size);
+        writable_ = writable;
+        return true;
+#else
+        std::FILE* fp = std::fopen(path.c_str(), "rb");
+        if (fp == nullptr) {
+            return false;
+        }
+        std::fseek(fp, 0, SEEK_END);
+        long len = std::ftell(fp);
+        std::fseek(fp, 0, SEEK_SET);
+        buf_.resize(len > 0 ? size_t(len) : 0);
+        bool ok = len > 0 && std::fread(buf_.data(), 1, buf_.size(), fp) == buf_.size();
+        std::fclose(fp);
+        if (!ok) {
+            buf_.clear();
+            return false;
+        }
+        data_ = buf_.data();
+        size_ = buf_.size();
+        writable_ = writable;
+        return true;
+#endif
+    }
+
+    /* truncates or creates path at exactly size bytes, zero filled */
+    bool create(const std::string& path, size_t size)
+    {
+        close();
+        path_ = path;
+        writable_ = true;
+#ifdef APP_HAS_MMAP
+        int fd = ::open(path.c_str(), O_RDWR | O_CREAT | O_TRUNC, 0644);
+        if (fd < 0) {
+            return false;
+        }
+        if (::ftruncate(fd, off_t(size)) != 0) {
+            ::close(fd);
+            return false;
+        }
+
+        void* addr = size ? ::mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0) : nullptr;
+        ::close(fd);
+        if (addr == MAP_FAILED) {
+            return false;
+        }
+        data_ = static_cast<char*>(addr);
+        size_ = size;
+        return true;
+#else
+        buf_.assign(size, 0);
+        data_ = buf_.data();
+        size_ = size;
+        return true;
+#endif
+    }
+
+    /* flushes a writable mapping to disk */
+    bool sync()
+    {
+        if (!writable_) {
+            return true;
+        }
+#ifdef APP_HAS_MMAP
+        return size_ == 0 || ::msync(data_, size_, MS_SYNC) == 0;
+#else
+        std::FILE* fp = std::fopen(path_.c_str(), "wb");
+        if (fp == nullptr) {
+            return false;
+        }
+        bool ok = std::fwrite(buf_.data(), 1, buf_.size(), fp) == buf_.size();
+        return std::fclose(fp) == 0 && ok;
+#endif
+    }
+
+    void advise(advice adv, size_t offset = 0, size_t len = size_t(-1))
+    {
+#ifdef APP_HAS_MMAP
+        static const long page = ::sysconf(_SC_PAGESIZE);
+        if (data_ == nullptr || offset >= size_) {
+            return;
+        }
+        size_t begin = offset / size_t(page) * size_t(page);
+        len = std::min(len, size_ - offset) + (offset - begin);
+        int flag = adv == sequential ? MADV_SEQUENTIAL
+                 : adv == random     ? MADV_RANDOM
+                 : adv == willneed   ? MADV_WILLNEED
+                 : MADV_NORMAL;
+        ::madvise(data_ + begin, len, flag);
+#else
+        (void)adv;
+        (void)offset;
+        (void)len;
+#endif
+    }
+
+    void close()
+    {
+        if (data_ == nullptr) {
+            return;
+        }
+#ifdef APP_HAS_MMAP
+        ::munmap(data_, size_);
+#else
+        if (writable_) {
+            sync();
+        }
+        buf_.clear();
+#endif
+        data_ = nullptr;
+        size_ = 0;
+        writable_ = false;
+    }
+
+    bool is_open() const
+    {
+        return data_ != nullptr;
+    }
+
+    char* data()
+    {
+        return data_;
+    }
+
+    const char* data() const
+    {
+        return data_;
+    }
+
+    size_t size() const
+    {
+        return size_;
+    }
+
+private:
+    mapped_file(const mapped_file&) = delete;
+    mapped_file& operator=(const mapped_file&) = delete;
+
+private:
+    char*               data_       { nullptr };
+    size_t              size_       { 0 };
+    bool                writable_   { false };
+    std::string         path_;
+    std::vector<char>   buf_;
+};
+
+};
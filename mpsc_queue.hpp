@@ -0,0 +1,227 @@
+#pragma once
+
+#include <mutex>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+
+#include "spinlock.h"
+
+namespace app
+{
+
+/* link hook embedded by the message type: struct msg : app::mpsc_hook { ... };
+ * copying a message never copies its link */
+struct mpsc_hook
+{
+    mpsc_hook() = default;
+    mpsc_hook(const mpsc_hook&) {}
+    mpsc_hook& operator=(const mpsc_hook&) { return *this; }
+
+    std::atomic<mpsc_hook*>     next_   { nullptr };
+};
+
+/* intrusive Vyukov MPSC queue: push is one atomic exchange and wait-free,
+ * pop and drain_all are single consumer. nodes are never allocated or copied,
+ * the queue only links them; a node may be reused once it has been popped */
+template <typename T>
+class mpsc_queue
+{
+public:
+    mpsc_queue()
+        : head_(&stubs_[0]), tail_(&stubs_[0]), stub_(&stubs_[0])
+    {
+    }
+
+    ~mpsc_queue() = default;
+
+    /* any thread */
+    void push(T* node)
+    {
+        link(static_cast<mpsc_hook*>(node));
+    }
+
+    /* owner only; nullptr when empty or when the newest push is still linking */
+    T* pop()
+    {
+        mpsc_hook* tail = tail_;
+        mpsc_hook* next = tail->next_.load(std::memory_order_acquire);
+        if (tail == stub_) {
+            if (next == nullptr) {
+                return nullptr;
+            }
+            tail_ = next;
+            tail = next;
+            next = next->next_.load(std::memory_order_acquire);
+        }
+
+        if (next != nullptr) {
+            tail_ = next;
+            return static_cast<T*>(tail);
+        }
+
+        if (tail != head_.load(std::memory_order_acquire)) {
+            return nullptr;
+        }
+
+        // tail is the last node, put the stub behind it so it can be taken
+        link(stub_);
+        next = tail->next_.load(std::memory_order_acquire);
+        if (next != nullptr) {
+            tail_ = next;
+            return static_cast<T*>(tail);
+        }
+        return nullptr;
+    }
+
+    /* owner only; detaches every pending node with one exchange and calls fn(T*) in fifo order.
+     * pop() may have re-linked the stub anywhere in the chain, so the chain is closed with
+     * the other stub and both are skipped while walking */
+    template <typename F>
+    size_t drain_all(F fn)
+    {
+        if (empty()) {
+            return 0;
+        }
+
+        mpsc_hook* first = tail_;
+        mpsc_hook* fresh = stub_ == &stubs_[0] ? &stubs_[1] : &stubs_[0];
+        fresh->next_.store(nullptr, std::memory_order_relaxed);
+        mpsc_hook* last = head_.exchange(fresh, std::memory_order_acq_rel);
+        tail_ = fresh;
+        stub_ = fresh;
+
+        size_t n = 0;
+        for (mpsc_hook* node = first;;) {
+            mpsc_hook* next = node == last ? nullptr : wait_next(node);
+            if (node != &stubs_[0] && node != &stubs_[1]) {
+                fn(static_cast<T*>(node));
+                ++n;
+            }
+            if (next == nullptr) {
+                return n;
+            }
+            node = next;
+        }
+    }
+
+    /* owner only */
+    bool empty() const
+    {
+        return tail_ == stub_ && head_.load(std::memory_order_acquire) == stub_;
+    }
+
+private:
+    void link(mpsc_hook* node)
+    {
+        node->next_.store(nullptr, std::memory_order_relaxed);
+        mpsc_hook* prev = head_.exchange(node, std::memory_order_seq_cst);
+        prev->next_.store(node, std::memory_order_release);
+    }
+
+    /* a producer between its exchange and its link store, only a few instructions */
+    static mpsc_hook* wait_next(mpsc_hook* node)
+    {
+        mpsc_hook* next = node->next_.load(std::memory_order_acquire);
+        for (; next == nullptr; next = node->next_.load(std::memory_order_acquire)) {
+            cpu_relax();
+        }
+        return next;
+    }
+
+private:
+    mpsc_queue(const mpsc_queue&) = delete;
+    mpsc_queue& operator=(const mpsc_queue&) = delete;
+
+private:
+    std::atomic<mpsc_hook*>     head_;
+    char                        pad_[64 - sizeof(std::atomic<mpsc_hook*>)];
+    mpsc_hook*                  tail_;
+    mpsc_hook*                  stub_;
+    mpsc_hook                   stubs_[2];
+};
+
+
+/* mpsc_queue plus parking: the owner sleeps while its mailbox is empty,
+ * a push only touches the mutex when the owner is actually asleep */
+template <typename T>
+class mailbox
+{
+public:
+    mailbox() = default;
+    ~mailbox() = default;
+
+    void push(T* node)
+    {
+        queue_.push(node);
+        if (sleeping_.load(std::memory_order_seq_cst) && sleeping_.exchange(false, std::memory_order_seq_cst)) {
+            std::lock_guard<std::mutex> lck(mtx_);
+            cond_.notify_one();
+        }
+    }
+
+    T* try_pop()
+    {
+        return queue_.pop();
+    }
+
+    T* wait_and_pop()
+    {
+        for (;;) {
+            T* node = queue_.pop();
+            if (node != nullptr) {
+                return node;
+            }
+            wait();
+        }
+    }
+
+    template <typename F>
+    size_t drain_all(F fn)
+    {
+        return queue_.drain_all(fn);
+    }
+
+    /* parks the owner until a push, returns at once if anything is pending */
+    void wait()
+    {
+        wait_for(std::chrono::milliseconds::max());
+    }
+
+    /* false on timeout */
+    bool wait_for(const std::chrono::milliseconds& timer)
+    {
+        if (!queue_.empty()) {
+            return true;
+        }
+
+        std::unique_lock<std::mutex> lck(mtx_);
+        sleeping_.store(true, std::memory_order_seq_cst);
+        if (!queue_.empty()) {
+            sleeping_.store(false, std::memory_order_relaxed);
+            return true;
+        }
+
+        auto awake = [this]() { return !sleeping_.load(std::memory_order_acquire); };
+        if (timer == std::chrono::milliseconds::max()) {
+            cond_.wait(lck, awake);
+            return true;
+        }
+
+        bool ok = cond_.wait_for(lck, timer, awake);
+        sleeping_.store(false, std::memory_order_relaxed);
+        return ok;
+    }
+
+private:
+    mailbox(const mailbox&) = delete;
+    mailbox& operator=(const mailbox&) = delete;
+
+private:
+    mpsc_queue<T>           queue_;
+    std::atomic<bool>       sleeping_   { false };
+    std::mutex              mtx_;
+    std::condition_variable cond_;
+};
+
+};
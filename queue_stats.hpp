@@ -0,0 +1,229 @@
+#pragma once
+
+#include <mutex>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <memory>
+
+#include "lock_profile.h"
+#include "safequeue.hpp"
+
+namespace app
+{
+
+/* per-thread slot index, threads beyond slots share slots */
+inline size_t queue_stats_slot()
+{
+    static std::atomic<size_t> next { 0 };
+    static thread_local size_t slot = next.fetch_add(1, std::memory_order_relaxed);
+    return slot;
+}
+
+struct queue_snapshot
+{
+    size_t      depth;              // 当前深度
+    size_t      high_watermark;     // 最高深度
+    uint64_t    pushes;
+    uint64_t    pops;
+    double      push_rate;          // 每秒, 相对上一次 snapshot
+    double      pop_rate;
+    uint64_t    sojourn_p50_ns;     // 采样的入队到出队时间
+    uint64_t    sojourn_p99_ns;
+    uint64_t    sojourn_max_ns;
+    uint64_t    idle_ns;            // 消费者在 wait_and_pop 中等待的总时间
+};
+
+/* counters live in cache line padded per-thread slots, only snapshot() aggregates */
+class queue_stats
+{
+public:
+    typedef std::chrono::steady_clock   clock;
+    enum { slots = 64 };
+
+    struct alignas(64) slot
+    {
+        std::atomic<uint64_t>   pushes  { 0 };
+        std::atomic<uint64_t>   pops    { 0 };
+        std::atomic<uint64_t>   idle_ns { 0 };
+        lock_histogram          sojourn;
+    };
+
+    /* stamp one push out of sample_rate for sojourn time */
+    explicit queue_stats(unsigned sample_rate = 16)
+        : rate_(sample_rate ? sample_rate : 1), last_(clock::now())
+    {
+    }
+
+    slot& local()
+    {
+        return slots_[queue_stats_slot() % slots];
+    }
+
+    bool sampled(const slot& s) const
+    {
+        return s.pushes.load(std::memory_order_relaxed) % rate_ == 0;
+    }
+
+    void depth(size_t depth)
+    {
+        size_t high = high_.load(std::memory_order_relaxed);
+        while (depth > high && !high_.compare_exchange_weak(high, depth, std::memory_order_relaxed));
+    }
+
+    queue_snapshot snapshot(size_t depth)
+    {
+        queue_snapshot snap = queue_snapshot();
+        lock_histogram sojourn;
+        for (auto& s : slots_) {
+            snap.pushes += s.pushes.load(std::memory_order_relaxed);
+            snap.pops += s.pops.load(std::memory_order_relaxed);
+            snap.idle_ns += s.idle_ns.load(std::memory_order_relaxed);
+            sojourn.merge(s.sojourn);
+        }
+
+        snap.depth = depth;
+        snap.high_watermark = high_.load(std::memory_order_relaxed);
+        snap.sojourn_p50_ns = sojourn.percentile(50);
+        snap.sojourn_p99_ns = sojourn.percentile(99);
+        snap.sojourn_max_ns = sojourn.max();
+
+        std::lock_guard<std::mutex> lck(mtx_);
+        auto now = clock::now();
+        double secs = std::chrono::duration<double>(now - last_).count();
+        if (secs > 0) {
+            snap.push_rate = (snap.pushes - last_pushes_) / secs;
+            snap.pop_rate = (snap.pops - last_pops_) / secs;
+        }
+        last_ = now;
+        last_pushes_ = snap.pushes;
+        last_pops_ = snap.pops;
+        return snap;
+    }
+
+private:
+    queue_stats(const queue_stats&) = delete;
+    queue_stats& operator=(const queue_stats&) = delete;
+
+private:
+    slot                    slots_[slots];
+    std::atomic<size_t>     high_           { 0 };
+    unsigned                rate_;
+    std::mutex              mtx_;
+    clock::time_point       last_;
+    uint64_t                last_pushes_    { 0 };
+    uint64_t                last_pops_      { 0 };
+};
+
+/* element wrapper carrying the enqueue timestamp, 0 when not sampled */
+template <typename T>
+struct stamped
+{
+    T           value;
+    int64_t     enqueued;
+
+    bool operator<(const stamped& other) const
+    {
+        return value < other.value;
+    }
+};
+
+/* safe_queue / safe_priorqueue with depth, rate, sojourn and idle telemetry */
+template <typename T, template <typename> class Queue = safe_queue>
+class monitored_queue
+{
+    typedef queue_stats::clock      clock;
+    typedef stamped<T>              item;
+
+public:
+    explicit monitored_queue(const char* name = "safe_queue", unsigned sample_rate = 16)
+        : queue_(name), stats_(sample_rate)
+    {
+    }
+
+    void push(T t)
+    {
+        auto& s = stats_.local();
+        int64_t stamp = stats_.sampled(s) ? now() : 0;
+        s.pushes.fetch_add(1, std::memory_order_relaxed);
+        queue_.push(item { std::move(t), stamp });
+        stats_.depth(queue_.size());
+    }
+
+    void wait_and_pop(T& val)
+    {
+        item it;
+        if (!queue_.try_pop(it)) {
+            int64_t start = now();
+            queue_.wait_and_pop(it);
+            stats_.local().idle_ns.fetch_add(now() - start, std::memory_order_relaxed);
+        }
+        popped(it, val);
+    }
+
+    bool wait_and_pop(T& val, const std::chrono::milliseconds& timer)
+    {
+        item it;
+        if (!queue_.try_pop(it)) {
+            int64_t start = now();
+            bool ok = queue_.wait_and_pop(it, timer);
+            stats_.local().idle_ns.fetch_add(now() - start, std::memory_order_relaxed);
+            if (!ok) {
+                return false;
+            }
+        }
+        popped(it, val);
+        return true;
+    }
+
+    bool try_pop(T& val)
+    {
+        item it;
+        if (!queue_.try_pop(it)) {
+            return false;
+        }
+        popped(it, val);
+        return true;
+    }
+
+    bool empty() const
+    {
+        return queue_.empty();
+    }
+
+    size_t size() const
+    {
+        return queue_.size();
+    }
+
+    queue_snapshot stats()
+    {
+        return stats_.snapshot(queue_.size());
+    }
+
+private:
+    static int64_t now()
+    {
+        return std::chrono::duration_cast<std::chrono::nanoseconds>(clock::now().time_since_epoch()).count();
+    }
+
+    void popped(item& it, T& val)
+    {
+        auto& s = stats_.local();
+        s.pops.fetch_add(1, std::memory_order_relaxed);
+        if (it.enqueued != 0) {
+            s.sojourn.record(uint64_t(now() - it.enqueued));
+        }
+        val = std::move(it.value);
+    }
+
+private:
+    monitored_queue(const monitored_queue&) = delete;
+    monitored_queue& operator=(const monitored_queue&) = delete;
+
+private:
+    Queue<item>     queue_;
+    queue_stats     stats_;
+};
+
+};
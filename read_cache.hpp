@@ -0,0 +1,113 @@
+#pragma once
+
+#include <vector>
+#include <cstdint>
+#include <cstddef>
+
+#include "unordered_map.hpp"
+
+namespace app
+{
+
+/* per-thread read-through cache in front of app::unordered_map for skewed lookups.
+ * a direct mapped table of recent hits, each stamped with the version of the map shard
+ * its key lives in; a hit costs one hash, one key compare and one atomic load of the
+ * shard version, no lock. writers bump the shard under the map lock, so any update or
+ * erase of a key drops the cached copies on every thread at their next lookup.
+ *   thread_local app::read_cache<map_t> cache(map);
+ *   cache.find(key, value);
+ * one cache per thread and map, it is not thread safe itself. writers should use
+ * map.assign() or map.replace(); a write through a reference from operator[] is seen once
+ * the writing thread calls into the map again, one through at() or an iterator only after
+ * map.touch(key). keys and values must be default constructible and copyable, misses and
+ * keys of a shard with such a write in flight are not cached */
+template <typename Map, size_t Slots = 1024>
+class read_cache
+{
+    static_assert(Slots != 0 && (Slots & (Slots - 1)) == 0, "read_cache slots must be a power of two");
+
+public:
+    typedef typename Map::key_type      key_type;
+    typedef typename Map::mapped_type   mapped_type;
+    typedef typename Map::hasher        hasher;
+    typedef typename Map::key_equal     key_equal;
+
+private:
+    struct entry
+    {
+        key_type        key;
+        mapped_type     value;
+        uint64_t        version { 0 };
+        bool            used    { false };
+    };
+
+public:
+    explicit read_cache(const Map& map)
+        : map_(map), hf_(map.hash_function()), eql_(map.key_eq()), entries_(Slots)
+    {
+        map_.attach_cache();
+    }
+
+    ~read_cache() = default;
+
+    bool find(const key_type& key, mapped_type& value)
+    {
+        size_t h = hf_(key);
+        entry& e = entries_[h & (Slots - 1)];
+        if (e.used && eql_(e.key, key) && e.version == map_.version(h)) {
+            ++hits_;
+            value = e.value;
+            return true;
+        }
+
+        ++misses_;
+        uint64_t version;
+        if (!map_.find(key, value, version)) {
+            return false;
+        }
+        if (version == Map::uncached_version) {
+            return true;
+        }
+        e.key = key;
+        e.value = value;
+        e.version = version;
+        e.used = true;
+        return true;
+    }
+
+    void clear()
+    {
+        for (auto& e : entries_) {
+            e.used = false;
+        }
+    }
+
+    const Map& map() const
+    {
+        return map_;
+    }
+
+    uint64_t hits() const
+    {
+        return hits_;
+    }
+
+    uint64_t misses() const
+    {
+        return misses_;
+    }
+
+private:
+    read_cache(const read_cache&) = delete;
+    read_cache& operator=(const read_cache&) = delete;
+
+private:
+    const Map&          map_;
+    hasher              hf_;
+    key_equal           eql_;
+    std::vector<entry>  entries_;
+    uint64_t            hits_       { 0 };
+    uint64_t            misses_     { 0 };
+};
+
+};
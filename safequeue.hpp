@@ -1,32 +1,138 @@
 #pragma once
 
 #include <mutex>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
 #include <memory>
+#include <thread>
+#include <vector>
 #include <condition_variable>
 #include <deque>
 #include <queue>
+#include <algorithm>
+#include <functional>
+
+#include "lock_profile.h"
 
 namespace app
 {
 
+/* one wake-up source shared by several queues, see queue_selector. waiters_ counts
+ * the threads inside a wait, a push with nobody waiting skips the mutex entirely */
+class queue_signal
+{
+public:
+    queue_signal() = default;
+    virtual ~queue_signal() = default;
+
+    /* seq_cst: pairs with the waiters_ increment before a waiter checks the queue sizes */
+    bool waiting() const
+    {
+        return waiters_.load(std::memory_order_seq_cst) != 0;
+    }
+
+    void notify()
+    {
+        {
+            std::lock_guard<std::mutex> lck(mtx_);
+            ++seq_;
+        }
+        cond_.notify_one();
+    }
+
+    /* the attached queue is being destroyed and has already dropped this signal */
+    virtual void released(const void* queue)
+    {
+        (void)queue;
+    }
+
+protected:
+    queue_signal(const queue_signal&) = delete;
+    queue_signal& operator=(const queue_signal&) = delete;
+
+protected:
+    std::mutex              mtx_;
+    std::condition_variable cond_;
+    uint64_t                seq_        { 0 };
+    std::atomic<uint32_t>   waiters_    { 0 };
+};
+
 template<typename T, typename _Container>
 class safe_queue_base
 {
 protected:
     typedef _Container                      Container;
-    typedef std::lock_guard<std::mutex>     lck_grd;
-    typedef std::unique_lock<std::mutex>    unq_lck;
+    typedef std::lock_guard<profiled_mutex> lck_grd;
+    typedef std::unique_lock<profiled_mutex> unq_lck;
 
 public:
-    safe_queue_base() = default;
-    ~safe_queue_base() = default;
+    /* name shows up in lock_registry dumps when built with APP_LOCK_PROFILE */
+    explicit safe_queue_base(const char* name = "safe_queue")
+    {
+        lock_profile_name(mtx_, name);
+    }
+
+    /* attached signals forget the queue, so a selector may outlive it */
+    ~safe_queue_base()
+    {
+        std::vector<queue_signal*> signals;
+        {
+            lck_grd lck(mtx_);
+            signals.swap(signals_);
+        }
+        for (auto signal : signals) {
+            signal->released(this);
+        }
+    }
 
     void push(T t)
     {
-        lck_grd lck(mtx_);
+        unq_lck lck(mtx_);
         queue_.push(std::move(t));
         ++size_;
         cond_.notify_one();
+        if (signals_.empty()) {
+            return;
+        }
+
+        // signals with a waiting dispatcher are woken after the queue lock is released,
+        // notifying_ keeps a detached signal alive until they are done
+        static thread_local std::vector<queue_signal*> wake;
+        wake.clear();
+        for (auto signal : signals_) {
+            if (signal->waiting()) {
+                wake.push_back(signal);
+            }
+        }
+        if (wake.empty()) {
+            return;
+        }
+        notifying_.fetch_add(1, std::memory_order_relaxed);
+        lck.unlock();
+        for (auto signal : wake) {
+            signal->notify();
+        }
+        notifying_.fetch_sub(1, std::memory_order_release);
+    }
+
+    /* also wake signal on pushes while a dispatcher waits on it */
+    void attach(queue_signal& signal)
+    {
+        lck_grd lck(mtx_);
+        signals_.push_back(&signal);
+    }
+
+    /* on return no push touches signal any more */
+    void detach(queue_signal& signal)
+    {
+        {
+            lck_grd lck(mtx_);
+            signals_.erase(std::remove(signals_.begin(), signals_.end(), &signal), signals_.end());
+        }
+        while (notifying_.load(std::memory_order_acquire) != 0) {
+            std::this_thread::yield();
+        }
     }
 
     void wait_and_pop(T& val)
@@ -113,7 +219,7 @@ public:
 
     inline bool empty() const
     {
-        return size_ != 0;
+        return size_ == 0;
     }
 
     inline size_t size() const
@@ -122,10 +228,12 @@ public:
     }
 
 protected:
-    Container               queue_;
-    std::mutex              mtx_;
-    std::condition_variable cond_;
-    std::atomic<size_t>     size_;
+    Container                   queue_;
+    mutable profiled_mutex      mtx_;
+    profiled_condition_variable cond_;
+    std::atomic<size_t>         size_       { 0 };
+    std::vector<queue_signal*>  signals_;
+    std::atomic<size_t>         notifying_  { 0 };
 };
 
 template<typename T>
@@ -138,14 +246,153 @@ public:
 
     const_reference front() const
     {
-        return top();
+        return this->top();
     }
 };
 
 template<class T>
-using safe_queue = safe_queue_base<T, std::deque<T>>;
+using safe_queue = safe_queue_base<T, std::queue<T>>;
 
 template<class T>
 using safe_priorqueue = safe_queue_base<T, priority_queue<T>>;
 
+/* blocks a dispatcher on several queues at once with a single wake-up source.
+ * wait_any returns the index of a ready queue, the caller then try_pop()s it
+ * and calls wait_any again if another dispatcher got there first.
+ * priority: the lowest ready index wins; weighted: smooth weighted round robin.
+ * a queue destroyed first detaches itself and its index is never reported again;
+ * destroying a queue and the selector at the same time is not allowed */
+class queue_selector
+    : protected queue_signal
+{
+public:
+    enum mode { priority, weighted };
+
+    explicit queue_selector(mode m = priority)
+        : mode_(m)
+    {
+    }
+
+    ~queue_selector()
+    {
+        for (auto& q : queues_) {
+            if (q.queue) {
+                q.detach();
+            }
+        }
+    }
+
+    /* returns the index wait_any reports for this queue; add queues before dispatching */
+    template <typename Queue>
+    size_t add(Queue& queue, int weight = 1)
+    {
+        entry e;
+        e.queue = &queue;
+        e.size = [&queue]() { return queue.size(); };
+        e.detach = [&queue, this]() { queue.detach(*this); };
+        e.weight = weight > 0 ? weight : 1;
+        e.current = 0;
+
+        size_t idx;
+        {
+            std::lock_guard<std::mutex> lck(mtx_);
+            queues_.push_back(std::move(e));
+            idx = queues_.size() - 1;
+        }
+        // outside mtx_, wait_any reads queue sizes while holding it
+        queue.attach(*this);
+        return idx;
+    }
+
+    /* -1 on timeout */
+    int wait_any(const std::chrono::milliseconds& timer = std::chrono::milliseconds::max())
+    {
+        auto deadline = timer == std::chrono::milliseconds::max()
+                      ? std::chrono::steady_clock::time_point::max()
+                      : std::chrono::steady_clock::now() + timer;
+
+        // counted before the sizes are read, so a push either shows in pick() or sees us waiting
+        waiters_.fetch_add(1, std::memory_order_seq_cst);
+        struct leave
+        {
+            std::atomic<uint32_t>& waiters;
+            ~leave() { waiters.fetch_sub(1, std::memory_order_relaxed); }
+        } guard { waiters_ };
+
+        std::unique_lock<std::mutex> lck(mtx_);
+        for (;;) {
+            int idx = pick();
+            if (idx >= 0) {
+                return idx;
+            }
+
+            uint64_t seq = seq_;
+            auto ready = [this, seq]() { return seq_ != seq; };
+            if (deadline == std::chrono::steady_clock::time_point::max()) {
+                cond_.wait(lck, ready);
+            }
+            else if (!cond_.wait_until(lck, deadline, ready)) {
+                return -1;
+            }
+        }
+    }
+
+    int try_any()
+    {
+        std::lock_guard<std::mutex> lck(mtx_);
+        return pick();
+    }
+
+private:
+    void released(const void* queue) override
+    {
+        std::lock_guard<std::mutex> lck(mtx_);
+        for (auto& q : queues_) {
+            if (q.queue == queue) {
+                q.queue = nullptr;
+            }
+        }
+    }
+
+private:
+    struct entry
+    {
+        const void*             queue;      // null once the queue is destroyed
+        std::function<size_t()> size;
+        std::function<void()>   detach;
+        int                     weight;
+        int                     current;
+    };
+
+    int pick()
+    {
+        int best = -1;
+        int total = 0;
+        for (size_t i = 0; i < queues_.size(); ++i) {
+            auto& q = queues_[i];
+            if (!q.queue || q.size() == 0) {
+                continue;
+            }
+            if (mode_ == priority) {
+                return int(i);
+            }
+
+            q.current += q.weight;
+            total += q.weight;
+            if (best < 0 || q.current > queues_[best].current) {
+                best = int(i);
+            }
+        }
+
+        if (best >= 0) {
+            queues_[best].current -= total;
+        }
+        return best;
+    }
+
+private:
+    mode                    mode_;
+    std::vector<entry>      queues_;
 };
+
+};
\ No newline at end of file
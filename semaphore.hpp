@@ -0,0 +1,301 @@
+#pragma once
+
+#include <mutex>
+#include <atomic>
+#include <chrono>
+#include <climits>
+#include <cstdint>
+#include <functional>
+#include <condition_variable>
+
+#if defined(__linux__)
+#   include <ctime>
+#   include <unistd.h>
+#   include <sys/syscall.h>
+#   include <linux/futex.h>
+#endif
+
+#include "spinlock.h"
+
+/* semaphore, latch and barrier on a single 32 bit word each: the fast path is one
+ * atomic, waiters spin briefly and then sleep on the word itself (futex on linux,
+ * a hashed mutex + condition variable elsewhere). a signal makes a syscall only when
+ * the matching sleepers_ count says someone actually sleeps */
+
+namespace app
+{
+
+#if defined(__linux__)
+
+inline bool futex_wait_for(std::atomic<uint32_t>& word, uint32_t old, std::chrono::nanoseconds timeout)
+{
+    struct timespec ts;
+    ts.tv_sec = time_t(timeout.count() / 1000000000);
+    ts.tv_nsec = long(timeout.count() % 1000000000);
+    return syscall(SYS_futex, reinterpret_cast<uint32_t*>(&word), FUTEX_WAIT_PRIVATE, old,
+                   timeout == std::chrono::nanoseconds::max() ? nullptr : &ts, nullptr, 0) == 0;
+}
+
+inline void futex_wake(std::atomic<uint32_t>& word, int count)
+{
+    syscall(SYS_futex, reinterpret_cast<uint32_t*>(&word), FUTEX_WAKE_PRIVATE, count, nullptr, nullptr, 0);
+}
+
+#else
+
+/* parking lot fallback, words hash onto a fixed set of buckets */
+struct futex_bucket
+{
+    std::mutex                  mtx;
+    std::condition_variable     cond;
+};
+
+inline futex_bucket& futex_bucket_of(const void* addr)
+{
+    static futex_bucket buckets[64];
+    return buckets[(reinterpret_cast<uintptr_t>(addr) >> 4) % 64];
+}
+
+inline bool futex_wait_for(std::atomic<uint32_t>& word, uint32_t old, std::chrono::nanoseconds timeout)
+{
+    futex_bucket& b = futex_bucket_of(&word);
+    std::unique_lock<std::mutex> lck(b.mtx);
+    if (word.load(std::memory_order_acquire) != old) {
+        return false;
+    }
+    if (timeout == std::chrono::nanoseconds::max()) {
+        b.cond.wait(lck);
+        return true;
+    }
+    return b.cond.wait_for(lck, timeout) == std::cv_status::no_timeout;
+}
+
+/* buckets are shared, so every sleeper on the bucket wakes and rechecks its word */
+inline void futex_wake(std::atomic<uint32_t>& word, int)
+{
+    futex_bucket& b = futex_bucket_of(&word);
+    std::lock_guard<std::mutex> lck(b.mtx);
+    b.cond.notify_all();
+}
+
+#endif
+
+inline void futex_wait(std::atomic<uint32_t>& word, uint32_t old)
+{
+    futex_wait_for(word, old, std::chrono::nanoseconds::max());
+}
+
+/* blocks while word == old: a short pause spin, then sleeps counted in sleepers.
+ * false if the deadline passed first */
+inline bool wait_while_equal(std::atomic<uint32_t>& word, uint32_t old, std::atomic<uint32_t>& sleepers,
+                             std::chrono::steady_clock::time_point deadline = std::chrono::steady_clock::time_point::max())
+{
+    for (int i = 0; i < 128; ++i) {
+        if (word.load(std::memory_order_acquire) != old) {
+            return true;
+        }
+        cpu_relax();
+    }
+
+    // pairs with the seq_cst change of word before the sleepers check in the signaller
+    sleepers.fetch_add(1, std::memory_order_seq_cst);
+    bool ok = true;
+    while (word.load(std::memory_order_seq_cst) == old) {
+        if (deadline == std::chrono::steady_clock::time_point::max()) {
+            futex_wait(word, old);
+            continue;
+        }
+
+        auto now = std::chrono::steady_clock::now();
+        if (now >= deadline) {
+            ok = false;
+            break;
+        }
+        futex_wait_for(word, old, deadline - now);
+    }
+    sleepers.fetch_sub(1, std::memory_order_relaxed);
+    return ok;
+}
+
+
+/* counting semaphore, release(n) wakes at most n sleepers */
+class semaphore
+{
+public:
+    explicit semaphore(uint32_t count = 0)
+        : count_(count)
+    {
+    }
+
+    ~semaphore() = default;
+
+    void acquire()
+    {
+        while (!try_acquire()) {
+            wait_while_equal(count_, 0, sleepers_);
+        }
+    }
+
+    bool try_acquire()
+    {
+        uint32_t count = count_.load(std::memory_order_relaxed);
+        while (count != 0) {
+            if (count_.compare_exchange_weak(count, count - 1, std::memory_order_acquire, std::memory_order_relaxed)) {
+                return true;
+            }
+        }
+        return false;
+    }
+
+    bool try_acquire_for(const std::chrono::milliseconds& timer)
+    {
+        auto deadline = std::chrono::steady_clock::now() + timer;
+        while (!try_acquire()) {
+            if (!wait_while_equal(count_, 0, sleepers_, deadline)) {
+                return try_acquire();
+            }
+        }
+        return true;
+    }
+
+    void release(uint32_t n = 1)
+    {
+        count_.fetch_add(n, std::memory_order_seq_cst);
+        if (sleepers_.load(std::memory_order_seq_cst) != 0) {
+            futex_wake(count_, n > uint32_t(INT_MAX) ? INT_MAX : int(n));
+        }
+    }
+
+    uint32_t available() const
+    {
+        return count_.load(std::memory_order_relaxed);
+    }
+
+private:
+    semaphore(const semaphore&) = delete;
+    semaphore& operator=(const semaphore&) = delete;
+
+private:
+    std::atomic<uint32_t>   count_;
+    std::atomic<uint32_t>   sleepers_   { 0 };
+};
+
+
+/* single use countdown, wait() returns once count_down brought it to zero */
+class latch
+{
+public:
+    explicit latch(uint32_t count)
+        : count_(count)
+    {
+    }
+
+    ~latch() = default;
+
+    void count_down(uint32_t n = 1)
+    {
+        if (count_.fetch_sub(n, std::memory_order_seq_cst) == n && sleepers_.load(std::memory_order_seq_cst) != 0) {
+            futex_wake(count_, INT_MAX);
+        }
+    }
+
+    bool try_wait() const
+    {
+        return count_.load(std::memory_order_acquire) == 0;
+    }
+
+    void wait()
+    {
+        for (uint32_t count = count_.load(std::memory_order_acquire); count != 0; count = count_.load(std::memory_order_acquire)) {
+            wait_while_equal(count_, count, sleepers_);
+        }
+    }
+
+    void arrive_and_wait(uint32_t n = 1)
+    {
+        count_down(n);
+        wait();
+    }
+
+private:
+    latch(const latch&) = delete;
+    latch& operator=(const latch&) = delete;
+
+private:
+    std::atomic<uint32_t>   count_;
+    std::atomic<uint32_t>   sleepers_   { 0 };
+};
+
+
+/* reusable barrier for phase synchronized workers. the last arrival runs the completion
+ * function, resets the count and bumps generation_; waiters spin on generation_ first, so
+ * at high thread counts most of them never sleep, and the sleepers are released by one
+ * wake on a word no woken thread has to lock */
+class barrier
+{
+public:
+    explicit barrier(uint32_t count, std::function<void()> completion = std::function<void()>())
+        : expected_(count), count_(count), completion_(std::move(completion))
+    {
+    }
+
+    ~barrier() = default;
+
+    /* true on the thread that completed the phase */
+    bool arrive_and_wait()
+    {
+        uint32_t gen = generation_.load(std::memory_order_acquire);
+        if (arrive()) {
+            return true;
+        }
+
+        while (generation_.load(std::memory_order_acquire) == gen) {
+            wait_while_equal(generation_, gen, sleepers_);
+        }
+        return false;
+    }
+
+    /* leaves the barrier for good, later phases expect one thread less */
+    void arrive_and_drop()
+    {
+        expected_.fetch_sub(1, std::memory_order_relaxed);
+        arrive();
+    }
+
+    uint32_t generation() const
+    {
+        return generation_.load(std::memory_order_acquire);
+    }
+
+private:
+    bool arrive()
+    {
+        if (count_.fetch_sub(1, std::memory_order_acq_rel) != 1) {
+            return false;
+        }
+
+        if (completion_) {
+            completion_();
+        }
+        count_.store(expected_.load(std::memory_order_relaxed), std::memory_order_relaxed);
+        generation_.fetch_add(1, std::memory_order_seq_cst);
+        if (sleepers_.load(std::memory_order_seq_cst) != 0) {
+            futex_wake(generation_, INT_MAX);
+        }
+        return true;
+    }
+
+private:
+    barrier(const barrier&) = delete;
+    barrier& operator=(const barrier&) = delete;
+
+private:
+    std::atomic<uint32_t>   expected_;
+    std::atomic<uint32_t>   count_;
+    char                    pad_[64 - sizeof(std::atomic<uint32_t>) * 2];
+    std::atomic<uint32_t>   generation_ { 0 };
+    std::atomic<uint32_t>   sleepers_   { 0 };
+    std::function<void()>   completion_;
+};
+
+};
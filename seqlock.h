@@ -0,0 +1,202 @@
+#pragma once
+
+#include <atomic>
+#include <cstdint>
+#include <cstring>
+#include <thread>
+#include <type_traits>
+
+namespace app
+{
+
+/* sequence lock for existing data: readers never write shared memory,
+ * they snapshot and retry if a writer bumped the sequence meanwhile */
+class seq_lock
+{
+public:
+
+    seq_lock() = default;
+    ~seq_lock() = default;
+
+public:
+
+    size_t read_begin() const
+    {
+        for (;;)
+        {
+            size_t seq = seq_.load(std::memory_order_acquire);
+            if ((seq & 1) == 0) {
+                return seq;
+            }
+            std::this_thread::yield();
+        }
+    }
+
+    bool read_retry(size_t seq) const
+    {
+        std::atomic_thread_fence(std::memory_order_acquire);
+        return seq_.load(std::memory_order_relaxed) != seq;
+    }
+
+    /* fn must only read, and must tolerate torn values that are discarded on retry */
+    template <typename F>
+    auto read(F fn) const -> decltype(fn())
+    {
+        for (;;)
+        {
+            size_t seq = read_begin();
+            auto val = fn();
+            if (!read_retry(seq)) {
+                return val;
+            }
+        }
+    }
+
+    void lock()
+    {
+        for (; !try_lock(); std::this_thread::yield());
+    }
+
+    bool try_lock()
+    {
+        size_t seq = seq_.load(std::memory_order_relaxed);
+        if ((seq & 1) != 0 || !seq_.compare_exchange_strong(seq, seq + 1, std::memory_order_acquire)) {
+            return false;
+        }
+
+        std::atomic_thread_fence(std::memory_order_release);
+        return true;
+    }
+
+    void unlock()
+    {
+        seq_.store(seq_.load(std::memory_order_relaxed) + 1, std::memory_order_release);
+    }
+
+    size_t sequence() const
+    {
+        return seq_.load(std::memory_order_relaxed);
+    }
+
+private:
+
+    seq_lock(const seq_lock&) = delete;
+    seq_lock(seq_lock&&) = delete;
+    seq_lock& operator=(const seq_lock&) = delete;
+    seq_lock& operator=(seq_lock&&) = delete;
+
+private:
+
+    std::atomic<size_t>     seq_    { 0 };
+};
+
+
+/* small trivially copyable value guarded by a sequence lock,
+ * copied word by word through relaxed atomics so readers never race */
+template <typename T>
+class seqlock
+{
+    static_assert(std::is_trivially_copyable<T>::value, "seqlock requires trivially copyable T");
+
+    typedef uintptr_t       word;
+    enum { words = (sizeof(T) + sizeof(word) - 1) / sizeof(word) };
+
+public:
+
+    seqlock()
+    {
+        store(T());
+    }
+
+    explicit seqlock(const T& val)
+    {
+        store(val);
+    }
+
+    ~seqlock() = default;
+
+public:
+
+    T load() const
+    {
+        T val;
+        load(val);
+        return val;
+    }
+
+    void load(T& val) const
+    {
+        word buf[words];
+        for (;;)
+        {
+            size_t seq = lock_.read_begin();
+            for (size_t i = 0; i < words; ++i) {
+                buf[i] = data_[i].load(std::memory_order_relaxed);
+            }
+            if (!lock_.read_retry(seq)) {
+                break;
+            }
+        }
+        std::memcpy(&val, buf, sizeof(T));
+    }
+
+    void store(const T& val)
+    {
+        lock_.lock();
+        write(val);
+        lock_.unlock();
+    }
+
+    /* read-modify-write under the writer lock, fn(T&) edits a private copy */
+    template <typename F>
+    void update(F fn)
+    {
+        lock_.lock();
+        T val = read();
+        fn(val);
+        write(val);
+        lock_.unlock();
+    }
+
+    size_t sequence() const
+    {
+        return lock_.sequence();
+    }
+
+private:
+
+    T read() const
+    {
+        word buf[words];
+        for (size_t i = 0; i < words; ++i) {
+            buf[i] = data_[i].load(std::memory_order_relaxed);
+        }
+
+        T val;
+        std::memcpy(&val, buf, sizeof(T));
+        return val;
+    }
+
+    void write(const T& val)
+    {
+        word buf[words] = {};
+        std::memcpy(buf, &val, sizeof(T));
+        for (size_t i = 0; i < words; ++i) {
+            data_[i].store(buf[i], std::memory_order_relaxed);
+        }
+    }
+
+private:
+
+    seqlock(const seqlock&) = delete;
+    seqlock(seqlock&&) = delete;
+    seqlock& operator=(const seqlock&) = delete;
+    seqlock& operator=(seqlock&&) = delete;
+
+private:
+
+    seq_lock                lock_;
+    std::atomic<word>       data_[words];
+};
+
+};
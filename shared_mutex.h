@@ -12,13 +12,45 @@
 #endif
 
 #if (defined(_WIN32) || __cplusplus >= 201103L)
+#include <map>
 #include <mutex>
+#include <thread>
+#include <cstdio>
+#include <cstdlib>
 #include <condition_variable>
 
 namespace app
 {
+/* 读写调度策略
+ * block_readers: 有写者等待时，新读者是否阻塞；
+ * readers_first: 写者释放时，是否优先放行已等待的读者；
+ */
+
+// 读者优先: 没有写者持有时读者立即进入; 读者等待不超过一个写临界区, 写者可能被持续的读者饿死(无上界)
+struct reader_prefer_policy
+{
+    static const bool block_readers = false;
+    static const bool readers_first = true;
+};
+
+// 写者优先: 有写者等待时新读者阻塞; 写者等待不超过当前读者退出加上排在前面的写者, 读者在连续的写者下可能饿死(无上界)
+struct writer_prefer_policy
+{
+    static const bool block_readers = true;
+    static const bool readers_first = false;
+};
+
+// 读写交替: 写者释放时先放行已等待的读者, 之后的新读者排在下一个写者之后;
+// 读者等待不超过一个写临界区, 写者等待不超过一个读阶段加上排在前面的写者
+struct phase_fair_policy
+{
+    static const bool block_readers = true;
+    static const bool readers_first = true;
+};
+
 // support c++11 but not support c++17 then implement shared_mutex
-class shared_mutex
+template <typename Policy>
+class basic_shared_mutex
 {
 protected:
     typedef std::mutex                          mutex;
@@ -28,24 +60,38 @@ protected:
     typedef std::map<trd_id, size_t>            map_depth;
 
 public:
-    shared_mutex() = default;
-    ~shared_mutex() = default;
+    typedef Policy                              policy_type;
+
+    basic_shared_mutex() = default;
+    ~basic_shared_mutex() = default;
 
 public:
     void lock_shared()
     {
+        trd_id id = std::this_thread::get_id();
         unique_lock lck(mtx_);
-        cond_r_.wait(lck, [&]() {
-            return readable();
-        });
-        read();
+        size_t phase = phase_;
+        if (!readable(id, phase)) {
+            ++wait_r_;
+            cond_r_.wait(lck, [&]() {
+                return readable(id, phase);
+            });
+            --wait_r_;
+        }
+
+        // 上一个写阶段结束前就在等待的读者
+        if (phase != phase_ && batch_r_ > 0) {
+            --batch_r_;
+        }
+        read(id);
     }
 
     bool try_lock_shared()
     {
+        trd_id id = std::this_thread::get_id();
         lock_guard lck(mtx_);
-        if (readable()) {
-            read();
+        if (readable(id, phase_)) {
+            read(id);
             return true;
         }
 
@@ -60,27 +106,25 @@ public:
 
         --read_cnt_;
         auto it = read_depth_.find(id);
-        utils_assert(it == read_depth_.end() || it->second > 0);
+        utils_assert(it != read_depth_.end() && it->second > 0);
 
-        size_t r_depth = --it->second;
-        if (r_depth == 0)
-        {
+        if (--it->second == 0) {
             read_depth_.erase(it);
         }
 
-        if (write_depth_ > 0) {
+        if (write_depth_ > 0 || wait_w_ == 0) {
             return;
         }
 
-        if (r_depth == 0) {
-            w_id_ = trd_id();
-            if (write_cnt_ > 0) {
-                return cond_w_.notify_one();
-            }
+        // 只唤醒能够继续的写者, 升级者优先; 升级者自己也持有读锁时, 剩下它一个读者即可升级
+        if (upgrading_ && convertible(up_id_)) {
+            cond_x_.notify_one();
         }
-
-        if(write_cnt_ == 0) {
-            return cond_r_.notify_all();
+        else if (read_depth_.empty()) {
+            cond_w_.notify_one();
+        }
+        else if (read_depth_.size() == 1 && wait_promote_ > 0) {
+            cond_w_.notify_all();
         }
     }
 
@@ -88,22 +132,30 @@ public:
     {
         trd_id id = std::this_thread::get_id();
         unique_lock lck(mtx_);
-        ++write_cnt_;
-
-        cond_w_.wait(lck, [&]() {
-            return writeable();
-        });
+        if (!writeable(id)) {
+            bool promote = read_depth_.find(id) != read_depth_.end();
+            ++wait_w_;
+            wait_promote_ += promote ? 1 : 0;
+            if (promote && upgrading_) {
+                // 升级者在等本线程的读锁退出, 让它放弃升级
+                cond_x_.notify_one();
+            }
+            cond_w_.wait(lck, [&]() {
+                return writeable(id);
+            });
+            wait_promote_ -= promote ? 1 : 0;
+            --wait_w_;
+        }
 
-        write();
+        write(id);
     }
 
     bool try_lock()
     {
         trd_id id = std::this_thread::get_id();
         lock_guard lck(mtx_);
-        if (writeable()) {
-            ++write_cnt_;
-            write();
+        if (writeable(id)) {
+            write(id);
             return true;
         }
 
@@ -114,24 +166,145 @@ public:
     {
         trd_id id = std::this_thread::get_id();
         lock_guard lck(mtx_);
-        utils_assert(write_cnt_ > 0);
+        utils_assert(write_depth_ > 0 && w_id_ == id);
 
-        --write_cnt_;
-        if (w_id_ == id) {
-            if (--write_depth_ != 0) {
-                return;
-            }
+        if (--write_depth_ != 0) {
+            return;
+        }
+
+        w_id_ = trd_id();
+        if (up_id_ == id) {
+            up_id_ = trd_id();
+        }
+
+        if (Policy::readers_first && (wait_r_ > 0 || wait_u_ > 0)) {
+            // 开启新的读阶段, 放行所有已等待的读者
+            ++phase_;
+            batch_r_ = wait_r_;
+            return notify_readers();
+        }
+
+        if (wait_w_ > 0) {
+            return cond_w_.notify_one();
+        }
+
+        notify_readers();
+    }
+
+    /* 升级锁: 与读者共存, 与写者和其他升级者互斥; 同一时刻最多一个升级者, 升级者之间不会死锁.
+     * 持有读锁的线程通过 lock() 直接升级为写时, 要等升级锁释放; 此时升级者若要升级为写,
+     * 双方互相等待, 由 upgrade_to_unique() 返回 false 让步. 需要读后写的线程应使用 lock_upgrade() */
+    void lock_upgrade()
+    {
+        trd_id id = std::this_thread::get_id();
+        unique_lock lck(mtx_);
+        utils_assert(up_id_ != id);
+
+        size_t phase = phase_;
+        if (!upgradeable(phase)) {
+            ++wait_u_;
+            cond_u_.wait(lck, [&]() {
+                return upgradeable(phase);
+            });
+            --wait_u_;
+        }
+
+        up_id_ = id;
+    }
+
+    bool try_lock_upgrade()
+    {
+        trd_id id = std::this_thread::get_id();
+        lock_guard lck(mtx_);
+        if (up_id_ != id && upgradeable(phase_)) {
+            up_id_ = id;
+            return true;
+        }
+
+        return false;
+    }
+
+    void unlock_upgrade()
+    {
+        trd_id id = std::this_thread::get_id();
+        lock_guard lck(mtx_);
+        utils_assert(up_id_ == id && w_id_ != id);
+
+        up_id_ = trd_id();
+        if (wait_u_ > 0) {
+            cond_u_.notify_one();
         }
 
-        if (read_depth_.find(id) == read_depth_.end()) {
-            w_id_ = trd_id();
+        if (wait_w_ == 0) {
+            return;
+        }
 
-            if (write_cnt_ > 0) {
-                return cond_w_.notify_one();
+        // 剩下的唯一读者可能正在等升级锁释放以升级为写
+        if (read_depth_.empty()) {
+            cond_w_.notify_one();
+        }
+        else if (read_depth_.size() == 1 && wait_promote_ > 0) {
+            cond_w_.notify_all();
+        }
+    }
+
+    /* 升级锁 -> 写锁: 等待其他读者退出, 期间按策略阻塞新读者.
+     * 有持有读锁的线程在 lock() 中等待升级锁释放时, 升级会死锁, 返回 false 且仍持有升级锁;
+     * 调用者应 unlock_upgrade() 放行它之后重试 */
+    bool upgrade_to_unique()
+    {
+        trd_id id = std::this_thread::get_id();
+        unique_lock lck(mtx_);
+        utils_assert(up_id_ == id && w_id_ != id);
+
+        if (!convertible(id)) {
+            ++wait_w_;
+            upgrading_ = true;
+            cond_x_.wait(lck, [&]() {
+                return convertible(id) || wait_promote_ > 0;
+            });
+            upgrading_ = false;
+            --wait_w_;
+            if (!convertible(id)) {
+                return false;
             }
         }
 
-        if (write_cnt_ == 0) {
+        write(id);
+        return true;
+    }
+
+    bool try_upgrade()
+    {
+        trd_id id = std::this_thread::get_id();
+        lock_guard lck(mtx_);
+        utils_assert(up_id_ == id && w_id_ != id);
+
+        if (convertible(id)) {
+            write(id);
+            return true;
+        }
+
+        return false;
+    }
+
+    /* 写锁 -> 升级锁: 放行等待中的读者, 写者仍需等待升级锁释放 */
+    void downgrade()
+    {
+        trd_id id = std::this_thread::get_id();
+        lock_guard lck(mtx_);
+        utils_assert(w_id_ == id && write_depth_ == 1);
+
+        write_depth_ = 0;
+        w_id_ = trd_id();
+        up_id_ = id;
+
+        if (Policy::readers_first && wait_r_ > 0) {
+            ++phase_;
+            batch_r_ = wait_r_;
+        }
+
+        if (wait_r_ > 0 && (!Policy::block_readers || Policy::readers_first || wait_w_ == 0)) {
             cond_r_.notify_all();
         }
     }
@@ -143,43 +316,64 @@ public:
 
 private:
 
-    inline bool readable()
+    inline bool readable(const trd_id& id, size_t phase)
     {
         /* 获得读的权限
-        1. 没有写的线程;
-        2. 当前线程正在写，同时读写；
+        1. 当前线程正在写，同时读写；
+        2. 当前线程正在读，递归读；
+        3. 没有写的线程，并且策略允许越过等待中的写者；
         */
 
-        if (write_cnt_ == 0)
+        if (w_id_ == id)
         {
             return true;
         }
 
-        if (w_id_ == std::this_thread::get_id())
+        if (w_id_ != trd_id())
+        {
+            return false;
+        }
+
+        if (read_depth_.find(id) != read_depth_.end())
         {
             return true;
         }
 
-        return false;
+        if (!Policy::block_readers || wait_w_ == 0)
+        {
+            return true;
+        }
+
+        // 读写交替: 上一个写阶段结束前就在等待的读者
+        return phase != phase_;
     }
 
-    inline bool writeable()
+    inline bool writeable(const trd_id& id)
     {
         /* 获得写的权限
-        1. 没有其他读进程，只有当前进程写；
-        2. 当前线程正在写，递归写；
+        1. 当前线程正在写，递归写；
+        2. 没有其他读线程、写线程和升级线程，并且没有被放行的读者；
         3. 当前线程正在读，不存在其他读线程；
         */
 
-        if (read_cnt_ == 0 && write_cnt_ == 1)
+        if (w_id_ == id)
         {
             return true;
         }
 
-        trd_id id = std::this_thread::get_id();
-        if (w_id_ == id)
+        if (w_id_ != trd_id())
         {
-            return true;
+            return false;
+        }
+
+        if (up_id_ != trd_id() && up_id_ != id)
+        {
+            return false;
+        }
+
+        if (read_depth_.empty())
+        {
+            return batch_r_ == 0;
         }
 
         if (read_depth_.size() == 1 && read_depth_.cbegin()->first == id)
@@ -190,33 +384,89 @@ private:
         return false;
     }
 
-    inline void read()
+    inline bool upgradeable(size_t phase)
+    {
+        /* 获得升级锁的权限
+        1. 没有写的线程和其他升级线程；
+        2. 与读者相同，按策略让位于等待中的写者；
+        */
+
+        if (w_id_ != trd_id() || up_id_ != trd_id())
+        {
+            return false;
+        }
+
+        if (!Policy::block_readers || wait_w_ == 0)
+        {
+            return true;
+        }
+
+        return phase != phase_;
+    }
+
+    inline bool convertible(const trd_id& id)
+    {
+        /* 升级为写: 不存在其他读线程 */
+
+        if (read_depth_.empty())
+        {
+            return true;
+        }
+
+        return read_depth_.size() == 1 && read_depth_.cbegin()->first == id;
+    }
+
+    inline void notify_readers()
+    {
+        if (wait_r_ > 0) {
+            cond_r_.notify_all();
+        }
+
+        if (wait_u_ > 0) {
+            cond_u_.notify_one();
+        }
+    }
+
+    inline void read(const trd_id& id)
     {
         ++read_cnt_;
-        ++read_depth_[std::this_thread::get_id()];
+        ++read_depth_[id];
     }
 
-    inline void write()
+    inline void write(const trd_id& id)
     {
         ++write_depth_;
-        w_id_ = std::this_thread::get_id();
+        w_id_ = id;
     }
 
 private:
-    shared_mutex(const shared_mutex&) = delete;
-    shared_mutex& operator=(const shared_mutex&) = delete;
+    basic_shared_mutex(const basic_shared_mutex&) = delete;
+    basic_shared_mutex& operator=(const basic_shared_mutex&) = delete;
 
 protected:
-    volatile size_t read_cnt_		{ 0 };		// 读者数量
-    volatile size_t write_cnt_		{ 0 };		// 写者数量
-    volatile size_t write_depth_	{ 0 };		// 写者深度
+    size_t read_cnt_				{ 0 };		// 读者数量
+    size_t wait_r_					{ 0 };		// 等待的读者数量
+    size_t wait_w_					{ 0 };		// 等待的写者数量
+    size_t wait_promote_			{ 0 };		// 等待读升级写的数量
+    size_t write_depth_				{ 0 };		// 写者深度
+    size_t phase_					{ 0 };		// 写阶段序号
+    size_t batch_r_					{ 0 };		// 本读阶段放行但尚未进入的读者
+    size_t wait_u_					{ 0 };		// 等待的升级者数量
+    bool upgrading_					{ false };	// 升级者正在等待升级为写
     mutable trd_id					w_id_;		// 当前写者
+    mutable trd_id					up_id_;		// 当前升级者
     mutable mutex					mtx_;		// 互斥锁
     mutable map_depth				read_depth_;// 读者深度
     std::condition_variable			cond_w_;	// 写者条件
     std::condition_variable			cond_r_;	// 读者条件
+    std::condition_variable			cond_u_;	// 升级者条件
+    std::condition_variable			cond_x_;	// 升级为写条件
 };
 
+typedef basic_shared_mutex<writer_prefer_policy>    shared_mutex;
+typedef basic_shared_mutex<reader_prefer_policy>    reader_prefer_shared_mutex;
+typedef basic_shared_mutex<phase_fair_policy>       phase_fair_shared_mutex;
+
 }
 #else
 // todo: not support c++11 then implement shared_mutex base on pthread
@@ -405,6 +655,71 @@ private:
     shared_lock&    shared_lock_;
     int             owns_ref_;
 };
+
+template <typename shared_lock>
+class upgrade_to_unique_guard;
+
+/* upgradable read: coexists with readers, at most one upgrader */
+template <typename shared_lock>
+class upgrade_guard
+{
+public:
+    explicit upgrade_guard(shared_lock& rw_)
+        : rw_lockable_(rw_)
+    {
+        rw_lockable_.lock_upgrade();
+    }
+
+    ~upgrade_guard()
+    {
+        rw_lockable_.unlock_upgrade();
+    }
+
+private:
+    upgrade_guard() = delete;
+    upgrade_guard(const upgrade_guard&) = delete;
+    upgrade_guard& operator=(const upgrade_guard&) = delete;
+
+    friend class upgrade_to_unique_guard<shared_lock>;
+
+private:
+    shared_lock& rw_lockable_;
+};
+
+/* upgrade to write in scope, downgrade back to upgradable read on exit.
+ * owns() is false when the upgrade gave way to a reader promoting through lock() */
+template <typename shared_lock>
+class upgrade_to_unique_guard
+{
+public:
+    explicit upgrade_to_unique_guard(upgrade_guard<shared_lock>& up_)
+        : rw_lockable_(up_.rw_lockable_)
+    {
+        owns_ = rw_lockable_.upgrade_to_unique();
+    }
+
+    ~upgrade_to_unique_guard()
+    {
+        if (owns_)
+        {
+            rw_lockable_.downgrade();
+        }
+    }
+
+    bool owns() const
+    {
+        return owns_;
+    }
+
+private:
+    upgrade_to_unique_guard() = delete;
+    upgrade_to_unique_guard(const upgrade_to_unique_guard&) = delete;
+    upgrade_to_unique_guard& operator=(const upgrade_to_unique_guard&) = delete;
+
+private:
+    shared_lock&    rw_lockable_;
+    bool            owns_;
+};
 };
 
 /* not thread write safe */
@@ -413,3 +728,6 @@ typedef app::scoped_read_guard<app::shared_mutex>   scoped_rguard;
 
 typedef app::unique_write_guard<app::shared_mutex>  unique_wguard;
 typedef app::unique_read_guard<app::shared_mutex>   unique_rguard;
+
+typedef app::upgrade_guard<app::shared_mutex>           upgrade_uguard;
+typedef app::upgrade_to_unique_guard<app::shared_mutex> upgrade_wguard;
@@ -0,0 +1,544 @@
+#pragma once
+
+#include <deque>
+#include <atomic>
+#include <cerrno>
+#include <memory>
+#include <string>
+#include <vector>
+#include <cstdio>
+#include <cstdint>
+#include <cstring>
+#include <algorithm>
+#include <stdexcept>
+#include <type_traits>
+
+#include "mapped_file.hpp"
+#include "safequeue.hpp"
+
+#ifdef APP_HAS_MMAP
+#   include <dirent.h>
+#   include <sys/stat.h>
+#endif
+
+namespace app
+{
+
+/* how spill_queue turns an item into bytes and back; decode reads straight from the
+ * mapped segment. the default covers trivially copyable types */
+template <typename T, typename Enable = void>
+struct spill_codec;
+
+template <typename T>
+struct spill_codec<T, typename std::enable_if<std::is_trivially_copyable<T>::value>::type>
+{
+    static size_t size(const T&)
+    {
+        return sizeof(T);
+    }
+
+    static void encode(const T& t, char* out)
+    {
+        std::memcpy(out, &t, sizeof(T));
+    }
+
+    static T decode(const char* in, size_t)
+    {
+        T t;
+        std::memcpy(&t, in, sizeof(T));
+        return t;
+    }
+};
+
+template <>
+struct spill_codec<std::string>
+{
+    static size_t size(const std::string& s)
+    {
+        return s.size();
+    }
+
+    static void encode(const std::string& s, char* out)
+    {
+        std::memcpy(out, s.data(), s.size());
+    }
+
+    static std::string decode(const char* in, size_t len)
+    {
+        return std::string(in, len);
+    }
+};
+
+struct spill_options
+{
+    std::string     dir;                                // segment files live here, one queue per directory
+    size_t          memory_items    { 65536 };          // items kept in memory before spilling, 0 spills everything
+    size_t          segment_bytes   { 64 << 20 };
+    size_t          keep_free       { 2 };              // drained segments kept mapped for reuse
+};
+
+
+/* Container for safe_queue_base: a bounded in-memory deque, and past memory_items a
+ * chain of mapped segment files holding length-prefixed records. once anything is on
+ * disk new items go to disk too and memory drains first, so fifo order holds. every
+ * segment header carries its read and write offsets, so what was spilled survives a
+ * process crash and is picked up again by open(); items still in memory do not.
+ * while spilling with no drained segment to reuse, spare_wanted() asks the owner for
+ * a segment made and prefaulted by make_spare() outside the queue lock */
+template <typename T, typename Codec = spill_codec<T> >
+class spill_container
+{
+    struct segment_header
+    {
+        uint32_t    magic;
+        uint32_t    version;
+        uint64_t    seq;
+        uint64_t    read_pos;
+        uint64_t    write_pos;
+        uint64_t    count;
+    };
+
+    struct segment
+    {
+        mapped_file     file;
+        std::string     path;
+
+        segment_header* header()
+        {
+            return reinterpret_cast<segment_header*>(file.data());
+        }
+    };
+
+    enum { magic = 0x4c505341, data_pos = 64, align = 8 };
+
+public:
+    typedef T           value_type;
+    typedef T&          reference;
+    typedef const T&    const_reference;
+
+    spill_container() = default;
+
+    /* segments still holding items stay on disk for the next open() */
+    ~spill_container()
+    {
+        for (auto& seg : active_) {
+            if (seg->header()->count == 0) {
+                seg->file.close();
+                std::remove(seg->path.c_str());
+            }
+        }
+        for (auto& seg : free_) {
+            seg->file.close();
+            std::remove(seg->path.c_str());
+        }
+        if (spare_ != nullptr) {
+            spare_->file.close();
+            std::remove(spare_->path.c_str());
+        }
+    }
+
+    /* adopts the segments left in opt.dir by an earlier run, returns the items recovered.
+     * a missing directory is created; if it cannot be, error() says why and pushes past
+     * memory_items stay in memory */
+    size_t open(const spill_options& opt)
+    {
+        opt_ = opt;
+        opt_.segment_bytes = std::max<size_t>(opt_.segment_bytes, 4096);
+        disk_count_ = 0;
+        error_ = 0;
+
+#ifdef APP_HAS_MMAP
+        DIR* dir = ::opendir(opt_.dir.c_str());
+        if (dir == nullptr && errno == ENOENT && ::mkdir(opt_.dir.c_str(), 0755) == 0) {
+            dir = ::opendir(opt_.dir.c_str());
+        }
+        if (dir == nullptr) {
+            error_ = errno;
+            return 0;
+        }
+
+        std::vector<std::unique_ptr<segment> > found;
+        for (struct dirent* ent = ::readdir(dir); ent != nullptr; ent = ::readdir(dir)) {
+            std::string name = ent->d_name;
+            if (name.compare(0, 6, "spill-") != 0 || name.size() < 10 || name.compare(name.size() - 4, 4, ".seg") != 0) {
+                continue;
+            }
+            unsigned long long id;
+            if (std::sscanf(name.c_str(), "spill-spare-%llx.seg", &id) == 1) {
+                spare_seq_.store(std::max<uint64_t>(spare_seq_.load(std::memory_order_relaxed), id + 1), std::memory_order_relaxed);
+            }
+
+            std::unique_ptr<segment> seg(new segment());
+            seg->path = opt_.dir + "/" + name;
+            if (!seg->file.open(seg->path, true) || seg->file.size() < data_pos || !valid(*seg)) {
+                seg->file.close();
+                std::remove(seg->path.c_str());
+                continue;
+            }
+            scan(*seg);
+            found.push_back(std::move(seg));
+        }
+        ::closedir(dir);
+
+        std::sort(found.begin(), found.end(), [](const std::unique_ptr<segment>& a, const std::unique_ptr<segment>& b) {
+            return a->header()->seq < b->header()->seq;
+        });
+        for (auto& seg : found) {
+            next_seq_ = std::max(next_seq_, seg->header()->seq + 1);
+            if (seg->header()->count == 0) {
+                recycle(std::move(seg));
+                continue;
+            }
+            disk_count_ += size_t(seg->header()->count);
+            active_.push_back(std::move(seg));
+        }
+#endif
+        return disk_count_;
+    }
+
+    void push(T t)
+    {
+        if (disk_count_ == 0 && mem_.size() < opt_.memory_items) {
+            mem_.push_back(std::move(t));
+            update_spare_wanted();
+            return;
+        }
+        if (!spill(t)) {
+            // the disk is full or failing: keep the item, it may overtake spilled ones
+            mem_.push_back(std::move(t));
+        }
+    }
+
+    T& front()
+    {
+        if (!mem_.empty()) {
+            return mem_.front();
+        }
+
+        if (head_.empty()) {
+            segment_header* h = active_.front()->header();
+            const char* rec = active_.front()->file.data() + h->read_pos;
+            uint32_t len;
+            std::memcpy(&len, rec, sizeof(len));
+            // open() checked every recovered record, this catches a file changed under us
+            if (h->write_pos - h->read_pos < sizeof(len) || len > h->write_pos - h->read_pos - sizeof(len)) {
+                throw std::runtime_error("spill_queue: corrupt record in " + active_.front()->path);
+            }
+            head_.push_back(Codec::decode(rec + sizeof(len), len));
+        }
+        return head_.front();
+    }
+
+    void pop()
+    {
+        if (!mem_.empty()) {
+            mem_.pop_front();
+            return;
+        }
+
+        head_.clear();
+        segment& seg = *active_.front();
+        segment_header* h = seg.header();
+        uint32_t len;
+        std::memcpy(&len, seg.file.data() + h->read_pos, sizeof(len));
+        h->read_pos = round(h->read_pos + sizeof(len) + len);
+        --h->count;
+        --disk_count_;
+
+        if (h->count != 0) {
+            return;
+        }
+        if (active_.size() > 1) {
+            std::unique_ptr<segment> done(std::move(active_.front()));
+            active_.pop_front();
+            recycle(std::move(done));
+        }
+        else {
+            // drained write segment, rewind it in place
+            h->read_pos = data_pos;
+            h->write_pos = data_pos;
+        }
+    }
+
+    bool empty() const
+    {
+        return mem_.empty() && disk_count_ == 0;
+    }
+
+    size_t size() const
+    {
+        return mem_.size() + disk_count_;
+    }
+
+    size_t spilled() const
+    {
+        return disk_count_;
+    }
+
+    /* errno of the last failure to open the directory or create a segment, 0 if none */
+    int error() const
+    {
+        return error_;
+    }
+
+    /* read without the queue lock by the owner before a push */
+    bool spare_wanted() const
+    {
+        return spare_wanted_.load(std::memory_order_relaxed);
+    }
+
+    /* creates and prefaults a segment file, called without the queue lock; opt_ is
+     * fixed once open() returned. nullptr and err set on failure */
+    std::unique_ptr<segment> make_spare(int& err)
+    {
+        char name[48];
+        unsigned long long id = spare_seq_.fetch_add(1, std::memory_order_relaxed);
+        std::snprintf(name, sizeof(name), "/spill-spare-%016llx.seg", id);
+        std::unique_ptr<segment> seg(new segment());
+        seg->path = opt_.dir + name;
+        if (!seg->file.create(seg->path, opt_.segment_bytes)) {
+            err = errno ? errno : EIO;
+            std::remove(seg->path.c_str());
+            return nullptr;
+        }
+        prefault(*seg);
+        return seg;
+    }
+
+    /* hands a segment from make_spare over, under the queue lock. after a failure no
+     * spare is asked for again until the next segment roll */
+    void adopt_spare(std::unique_ptr<segment> seg, int err)
+    {
+        if (seg == nullptr) {
+            error_ = err;
+            spare_wanted_.store(false, std::memory_order_relaxed);
+            return;
+        }
+        if (spare_ == nullptr) {
+            spare_ = std::move(seg);
+        }
+        else {
+            seg->file.close();
+            std::remove(seg->path.c_str());
+        }
+        update_spare_wanted();
+    }
+
+    /* forces spilled records to disk, the page cache already survives a process crash */
+    bool sync()
+    {
+        bool ok = true;
+        for (auto& seg : active_) {
+            ok = seg->file.sync() && ok;
+        }
+        return ok;
+    }
+
+private:
+    static uint64_t round(uint64_t pos)
+    {
+        return (pos + align - 1) / align * align;
+    }
+
+    static bool valid(segment& seg)
+    {
+        segment_header* h = seg.header();
+        return h->magic == magic && h->version == 1
+            && h->read_pos >= data_pos && h->read_pos <= h->write_pos && h->write_pos <= seg.file.size();
+    }
+
+    /* walks the records of a recovered segment, cutting it at the first one that does not
+     * fit before write_pos, so front() never decodes past the written data */
+    static void scan(segment& seg)
+    {
+        segment_header* h = seg.header();
+        uint64_t pos = h->read_pos;
+        uint64_t count = 0;
+        while (count < h->count && h->write_pos - pos >= sizeof(uint32_t)) {
+            uint32_t len;
+            std::memcpy(&len, seg.file.data() + pos, sizeof(len));
+            if (len > h->write_pos - pos - sizeof(len)) {
+                break;
+            }
+            pos = std::min<uint64_t>(round(pos + sizeof(len) + len), h->write_pos);
+            ++count;
+        }
+        h->write_pos = pos;
+        h->count = count;
+    }
+
+    /* touches every page so later appends do not fault in new blocks under the queue lock */
+    static void prefault(segment& seg)
+    {
+        volatile char* data = seg.file.data();
+        for (size_t off = 0; off < seg.file.size(); off += 4096) {
+            data[off] = 0;
+        }
+    }
+
+    void update_spare_wanted()
+    {
+        bool wanted = spare_ == nullptr && free_.empty() && error_ == 0
+                   && (disk_count_ > 0 || mem_.size() >= opt_.memory_items / 2);
+        spare_wanted_.store(wanted, std::memory_order_relaxed);
+    }
+
+    bool spill(const T& t)
+    {
+        size_t len = Codec::size(t);
+        uint64_t need = round(sizeof(uint32_t) + len);
+        if (len > UINT32_MAX) {
+            return false;
+        }
+
+        segment* seg = active_.empty() ? nullptr : active_.back().get();
+        if (seg == nullptr || seg->header()->write_pos + need > seg->file.size()) {
+            seg = roll(size_t(need));
+            if (seg == nullptr) {
+                return false;
+            }
+        }
+
+        segment_header* h = seg->header();
+        char* rec = seg->file.data() + h->write_pos;
+        uint32_t len32 = uint32_t(len);
+        std::memcpy(rec, &len32, sizeof(len32));
+        Codec::encode(t, rec + sizeof(len32));
+        h->write_pos += need;
+        ++h->count;
+        ++disk_count_;
+        return true;
+    }
+
+    /* a fresh write segment, recycled when one of the right size is free */
+    segment* roll(size_t need)
+    {
+        if (active_.size() == 1 && active_.back()->header()->count == 0) {
+            std::unique_ptr<segment> empty(std::move(active_.back()));
+            active_.pop_back();
+            recycle(std::move(empty));
+        }
+
+        std::unique_ptr<segment> seg;
+        size_t bytes = std::max<size_t>(opt_.segment_bytes, data_pos + need);
+        if (!free_.empty() && free_.back()->file.size() >= bytes) {
+            seg = std::move(free_.back());
+            free_.pop_back();
+        }
+        else if (spare_ != nullptr && spare_->file.size() >= bytes) {
+            seg = std::move(spare_);
+        }
+        else {
+            // no spare was ready, the segment is made here under the queue lock
+            char name[48];
+            std::snprintf(name, sizeof(name), "/spill-%016llx.seg", static_cast<unsigned long long>(next_seq_));
+            seg.reset(new segment());
+            seg->path = opt_.dir + name;
+            if (!seg->file.create(seg->path, bytes)) {
+                error_ = errno ? errno : EIO;
+                return nullptr;
+            }
+        }
+        error_ = 0;
+
+        segment_header* h = seg->header();
+        h->magic = magic;
+        h->version = 1;
+        h->seq = next_seq_++;
+        h->read_pos = data_pos;
+        h->write_pos = data_pos;
+        h->count = 0;
+        seg->file.advise(mapped_file::sequential);
+        active_.push_back(std::move(seg));
+        update_spare_wanted();
+        return active_.back().get();
+    }
+
+    void recycle(std::unique_ptr<segment> seg)
+    {
+        segment_header* h = seg->header();
+        h->read_pos = data_pos;
+        h->write_pos = data_pos;
+        h->count = 0;
+        if (free_.size() < opt_.keep_free && seg->file.size() == opt_.segment_bytes) {
+            free_.push_back(std::move(seg));
+            return;
+        }
+        seg->file.close();
+        std::remove(seg->path.c_str());
+    }
+
+private:
+    spill_options                               opt_;
+    std::deque<T>                               mem_;
+    std::deque<std::unique_ptr<segment> >       active_;
+    std::vector<std::unique_ptr<segment> >      free_;
+    std::vector<T>                              head_;
+    std::unique_ptr<segment>                    spare_;
+    size_t                                      disk_count_ { 0 };
+    uint64_t                                    next_seq_   { 0 };
+    int                                         error_      { 0 };
+    std::atomic<bool>                           spare_wanted_   { false };
+    std::atomic<uint64_t>                       spare_seq_      { 0 };
+};
+
+
+/* safe_queue whose memory stays bounded: past opt.memory_items items go to segment
+ * files in opt.dir. under the queue lock an append is a copy into a mapped, prefaulted
+ * page and a segment roll takes a drained segment or a spare; the producer that sees
+ * no spare ready makes one in push() before it takes the lock. only when spares cannot
+ * keep up is a segment file created with the lock held */
+template <typename T, typename Codec = spill_codec<T> >
+class spill_queue
+    : public safe_queue_base<T, spill_container<T, Codec> >
+{
+    typedef safe_queue_base<T, spill_container<T, Codec> >  base;
+
+public:
+    explicit spill_queue(const spill_options& opt, const char* name = "spill_queue")
+        : base(name)
+    {
+        typename base::lck_grd lck(this->mtx_);
+        this->size_ = this->queue_.open(opt);
+    }
+
+    void push(T t)
+    {
+        if (this->queue_.spare_wanted() && !making_spare_.exchange(true, std::memory_order_acquire)) {
+            int err = 0;
+            auto spare = this->queue_.make_spare(err);
+            {
+                typename base::lck_grd lck(this->mtx_);
+                this->queue_.adopt_spare(std::move(spare), err);
+            }
+            making_spare_.store(false, std::memory_order_release);
+        }
+        base::push(std::move(t));
+    }
+
+    /* items currently on disk */
+    size_t spilled() const
+    {
+        typename base::lck_grd lck(this->mtx_);
+        return this->queue_.spilled();
+    }
+
+    /* errno of the last failure to open opt.dir or create a segment, 0 if none; while
+     * set, pushes past memory_items stay in memory */
+    int error() const
+    {
+        typename base::lck_grd lck(this->mtx_);
+        return this->queue_.error();
+    }
+
+    bool sync()
+    {
+        typename base::lck_grd lck(this->mtx_);
+        return this->queue_.sync();
+    }
+
+private:
+    std::atomic<bool>   making_spare_   { false };
+};
+
+};
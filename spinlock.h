@@ -3,11 +3,55 @@
 #include <mutex>
 #include <atomic>
 #include <chrono>
+#include <thread>
 #include <condition_variable>
 
+#if defined(_MSC_VER)
+#   include <intrin.h>
+#endif
+
 namespace app
 {
 
+inline void cpu_relax()
+{
+#if defined(_MSC_VER)
+    _mm_pause();
+#elif defined(__i386__) || defined(__x86_64__)
+    __builtin_ia32_pause();
+#elif defined(__aarch64__) || defined(__arm__)
+    __asm__ __volatile__("yield");
+#endif
+}
+
+/* exponential pause backoff, falls back to yield once the spin budget is spent */
+class spin_backoff
+{
+public:
+
+    void pause()
+    {
+        if (spins_ < 64) {
+            for (int i = 0; i < spins_; ++i) {
+                cpu_relax();
+            }
+            spins_ <<= 1;
+        }
+        else {
+            std::this_thread::yield();
+        }
+    }
+
+    void reset()
+    {
+        spins_ = 1;
+    }
+
+private:
+
+    int spins_  { 1 };
+};
+
 class spin_lock
 {
 public:
@@ -110,4 +154,82 @@ private:
     int try_cnt_            { 200 };
 };
 
+
+/* reader-writer spin lock for short critical sections, state packed in one word:
+ * bit 0 writer held, bit 1 writer pending, the rest is the reader count.
+ * new readers back off while a writer is pending, so writers are not starved.
+ * not recursive */
+class rw_spin_lock
+{
+    enum : size_t
+    {
+        writer  = 1,
+        pending = 2,
+        reader  = 4,
+    };
+
+public:
+
+    rw_spin_lock() = default;
+    ~rw_spin_lock() = default;
+
+public:
+
+    void lock_shared()
+    {
+        for (spin_backoff backoff; !try_lock_shared(); backoff.pause());
+    }
+
+    bool try_lock_shared()
+    {
+        size_t state = state_.load(std::memory_order_relaxed);
+        return (state & (writer | pending)) == 0
+            && state_.compare_exchange_weak(state, state + reader, std::memory_order_acquire, std::memory_order_relaxed);
+    }
+
+    void unlock_shared()
+    {
+        state_.fetch_sub(reader, std::memory_order_release);
+    }
+
+    void lock()
+    {
+        for (spin_backoff backoff;; backoff.pause())
+        {
+            size_t state = state_.load(std::memory_order_relaxed);
+            if ((state & ~size_t(pending)) == 0) {
+                if (state_.compare_exchange_weak(state, writer, std::memory_order_acquire, std::memory_order_relaxed)) {
+                    return;
+                }
+            }
+            else if ((state & pending) == 0) {
+                state_.fetch_or(pending, std::memory_order_relaxed);
+            }
+        }
+    }
+
+    bool try_lock()
+    {
+        size_t state = state_.load(std::memory_order_relaxed);
+        return (state & ~size_t(pending)) == 0
+            && state_.compare_exchange_strong(state, writer, std::memory_order_acquire, std::memory_order_relaxed);
+    }
+
+    void unlock()
+    {
+        state_.fetch_and(~size_t(writer), std::memory_order_release);
+    }
+
+private:
+
+    rw_spin_lock(const rw_spin_lock&) = delete;
+    rw_spin_lock(rw_spin_lock&&) = delete;
+    rw_spin_lock& operator=(const rw_spin_lock&) = delete;
+    rw_spin_lock& operator=(rw_spin_lock&&) = delete;
+
+private:
+
+    std::atomic<size_t>     state_  { 0 };
+};
+
 };
\ No newline at end of file
@@ -0,0 +1,381 @@
+#pragma once
+
+#include <new>
+#include <atomic>
+#include <thread>
+#include <cstdint>
+#include <type_traits>
+#include <algorithm>
+#include <functional>
+
+/* LongAdder style counters: an uncontended counter is one word, the first failed CAS
+ * spreads it over cache line aligned per-core cells and each thread sticks to a cell
+ * until it collides again. add() stays a single uncontended CAS whatever the thread
+ * count, read() pays for it by summing the cells. both types copy as a snapshot so
+ * they can live in app::unordered_map; copy or reset only while no thread is adding.
+ * the counters themselves are line aligned too, heap arrays and map nodes rely on
+ * C++17 aligned new for that */
+
+namespace app
+{
+
+/* per-thread cell selector, moved by a xorshift step after a collision */
+inline uint32_t& stripe_probe()
+{
+    static thread_local uint32_t probe = uint32_t(std::hash<std::thread::id>()(std::this_thread::get_id())) | 1;
+    return probe;
+}
+
+inline void stripe_advance(uint32_t& probe)
+{
+    probe ^= probe << 13;
+    probe ^= probe >> 17;
+    probe ^= probe << 5;
+}
+
+/* cache line aligned array of n trivially destructible T; C++17 aligned new does it,
+ * before that the block is over-allocated and the raw pointer kept just below it */
+template <typename T>
+inline T* stripe_alloc(size_t n)
+{
+    static_assert(std::is_trivially_destructible<T>::value, "stripe_alloc skips destructors");
+#ifdef __cpp_aligned_new
+    return new T[n];
+#else
+    void* raw = ::operator new(sizeof(T) * n + 64 + sizeof(void*));
+    uintptr_t at = (reinterpret_cast<uintptr_t>(raw) + sizeof(void*) + 63) & ~uintptr_t(63);
+    reinterpret_cast<void**>(at)[-1] = raw;
+    T* arr = reinterpret_cast<T*>(at);
+    for (size_t i = 0; i < n; ++i) {
+        new (arr + i) T();
+    }
+    return arr;
+#endif
+}
+
+template <typename T>
+inline void stripe_free(T* arr)
+{
+#ifdef __cpp_aligned_new
+    delete[] arr;
+#else
+    if (arr != nullptr) {
+        ::operator delete(reinterpret_cast<void**>(arr)[-1]);
+    }
+#endif
+}
+
+/* cells per counter, a power of two no smaller than the core count */
+inline size_t stripe_count()
+{
+    static const size_t count = []() {
+        size_t n = 1;
+        for (; n < std::max(1u, std::thread::hardware_concurrency()); n <<= 1);
+        return n;
+    }();
+    return count;
+}
+
+
+class alignas(64) striped_counter
+{
+    struct alignas(64) cell
+    {
+        std::atomic<int64_t>    value   { 0 };
+    };
+
+public:
+    striped_counter() = default;
+
+    explicit striped_counter(int64_t value)
+        : base_(value)
+    {
+    }
+
+    striped_counter(const striped_counter& other)
+        : base_(other.read())
+    {
+    }
+
+    striped_counter& operator=(const striped_counter& other)
+    {
+        int64_t value = other.read();
+        reset();
+        base_.store(value, std::memory_order_relaxed);
+        return *this;
+    }
+
+    ~striped_counter()
+    {
+        stripe_free(cells_.load(std::memory_order_relaxed));
+    }
+
+    void add(int64_t n)
+    {
+        cell* cells = cells_.load(std::memory_order_acquire);
+        if (cells == nullptr) {
+            int64_t value = base_.load(std::memory_order_relaxed);
+            if (base_.compare_exchange_strong(value, value + n, std::memory_order_relaxed)) {
+                return;
+            }
+            cells = expand();
+        }
+
+        uint32_t& probe = stripe_probe();
+        for (size_t mask = stripe_count() - 1;; stripe_advance(probe)) {
+            auto& c = cells[probe & mask].value;
+            int64_t value = c.load(std::memory_order_relaxed);
+            if (c.compare_exchange_strong(value, value + n, std::memory_order_relaxed)) {
+                return;
+            }
+        }
+    }
+
+    void inc()
+    {
+        add(1);
+    }
+
+    void dec()
+    {
+        add(-1);
+    }
+
+    striped_counter& operator+=(int64_t n)
+    {
+        add(n);
+        return *this;
+    }
+
+    striped_counter& operator-=(int64_t n)
+    {
+        add(-n);
+        return *this;
+    }
+
+    /* not a point in time snapshot while adds are running, but never loses one */
+    int64_t read() const
+    {
+        int64_t sum = base_.load(std::memory_order_relaxed);
+        cell* cells = cells_.load(std::memory_order_acquire);
+        for (size_t i = 0; cells != nullptr && i < stripe_count(); ++i) {
+            sum += cells[i].value.load(std::memory_order_relaxed);
+        }
+        return sum;
+    }
+
+    /* for periodic reporting: every add lands in exactly one interval */
+    int64_t read_and_reset()
+    {
+        int64_t sum = base_.exchange(0, std::memory_order_relaxed);
+        cell* cells = cells_.load(std::memory_order_acquire);
+        for (size_t i = 0; cells != nullptr && i < stripe_count(); ++i) {
+            sum += cells[i].value.exchange(0, std::memory_order_relaxed);
+        }
+        return sum;
+    }
+
+    void reset()
+    {
+        read_and_reset();
+    }
+
+private:
+    cell* expand()
+    {
+        cell* cells = stripe_alloc<cell>(stripe_count());
+        cell* expect = nullptr;
+        if (!cells_.compare_exchange_strong(expect, cells, std::memory_order_acq_rel, std::memory_order_acquire)) {
+            stripe_free(cells);
+            return expect;
+        }
+        return cells;
+    }
+
+private:
+    std::atomic<int64_t>    base_   { 0 };
+    std::atomic<cell*>      cells_  { nullptr };
+};
+
+
+/* what striped_histogram::read() returns */
+struct histogram_snapshot
+{
+    enum { buckets = 40 };
+
+    uint64_t    counts[buckets];        // log2 buckets of the recorded value, as lock_histogram
+    uint64_t    count;
+    uint64_t    sum;
+    uint64_t    max;
+
+    double mean() const
+    {
+        return count ? double(sum) / double(count) : 0;
+    }
+
+    /* upper bound of the bucket holding the pct quantile, pct in [0, 100] */
+    uint64_t percentile(double pct) const
+    {
+        if (count == 0) {
+            return 0;
+        }
+
+        uint64_t rank = static_cast<uint64_t>(count * pct / 100.0);
+        uint64_t seen = 0;
+        for (size_t idx = 0; idx < buckets; ++idx) {
+            seen += counts[idx];
+            if (seen > rank) {
+                return std::min<uint64_t>(uint64_t(2) << idx, max);
+            }
+        }
+        return max;
+    }
+};
+
+
+/* log2 histogram striped the same way as striped_counter, for latencies and sizes */
+class alignas(64) striped_histogram
+{
+    enum { buckets = histogram_snapshot::buckets };
+
+    struct alignas(64) stripe
+    {
+        std::atomic<uint64_t>   counts[buckets];
+        std::atomic<uint64_t>   sum;
+    };
+
+public:
+    striped_histogram()
+    {
+        clear(base_);
+    }
+
+    striped_histogram(const striped_histogram& other)
+    {
+        clear(base_);
+        fold(other.read());
+    }
+
+    striped_histogram& operator=(const striped_histogram& other)
+    {
+        histogram_snapshot snap = other.read();
+        reset();
+        fold(snap);
+        return *this;
+    }
+
+    ~striped_histogram()
+    {
+        stripe_free(stripes_.load(std::memory_order_relaxed));
+    }
+
+    void record(uint64_t value)
+    {
+        size_t idx = 0;
+        for (; (value >> idx) > 1 && idx + 1 < buckets; ++idx);
+
+        // every update goes through the stripe's sum, so a failed CAS on it is the collision
+        // signal whichever bucket the other thread hit; the bucket count follows uncontended
+        stripe* s = stripes_.load(std::memory_order_acquire);
+        if (s == nullptr) {
+            uint64_t sum = base_.sum.load(std::memory_order_relaxed);
+            if (base_.sum.compare_exchange_strong(sum, sum + value, std::memory_order_relaxed)) {
+                base_.counts[idx].fetch_add(1, std::memory_order_relaxed);
+                update_max(value);
+                return;
+            }
+            s = expand();
+        }
+
+        uint32_t& probe = stripe_probe();
+        for (size_t mask = stripe_count() - 1;; stripe_advance(probe)) {
+            stripe& own = s[probe & mask];
+            uint64_t sum = own.sum.load(std::memory_order_relaxed);
+            if (own.sum.compare_exchange_strong(sum, sum + value, std::memory_order_relaxed)) {
+                own.counts[idx].fetch_add(1, std::memory_order_relaxed);
+                break;
+            }
+        }
+        update_max(value);
+    }
+
+    histogram_snapshot read() const
+    {
+        histogram_snapshot snap = histogram_snapshot();
+        add(snap, base_);
+        stripe* s = stripes_.load(std::memory_order_acquire);
+        for (size_t i = 0; s != nullptr && i < stripe_count(); ++i) {
+            add(snap, s[i]);
+        }
+        for (auto cnt : snap.counts) {
+            snap.count += cnt;
+        }
+        snap.max = max_.load(std::memory_order_relaxed);
+        return snap;
+    }
+
+    void reset()
+    {
+        clear(base_);
+        stripe* s = stripes_.load(std::memory_order_acquire);
+        for (size_t i = 0; s != nullptr && i < stripe_count(); ++i) {
+            clear(s[i]);
+        }
+        max_.store(0, std::memory_order_relaxed);
+    }
+
+private:
+    static void clear(stripe& s)
+    {
+        for (auto& cnt : s.counts) {
+            cnt.store(0, std::memory_order_relaxed);
+        }
+        s.sum.store(0, std::memory_order_relaxed);
+    }
+
+    static void add(histogram_snapshot& snap, const stripe& s)
+    {
+        for (size_t idx = 0; idx < buckets; ++idx) {
+            snap.counts[idx] += s.counts[idx].load(std::memory_order_relaxed);
+        }
+        snap.sum += s.sum.load(std::memory_order_relaxed);
+    }
+
+    void fold(const histogram_snapshot& snap)
+    {
+        for (size_t idx = 0; idx < buckets; ++idx) {
+            base_.counts[idx].fetch_add(snap.counts[idx], std::memory_order_relaxed);
+        }
+        base_.sum.fetch_add(snap.sum, std::memory_order_relaxed);
+        update_max(snap.max);
+    }
+
+    /* the max line is only written while the maximum still grows */
+    void update_max(uint64_t value)
+    {
+        uint64_t max = max_.load(std::memory_order_relaxed);
+        while (value > max && !max_.compare_exchange_weak(max, value, std::memory_order_relaxed));
+    }
+
+    stripe* expand()
+    {
+        stripe* s = stripe_alloc<stripe>(stripe_count());
+        for (size_t i = 0; i < stripe_count(); ++i) {
+            clear(s[i]);
+        }
+
+        stripe* expect = nullptr;
+        if (!stripes_.compare_exchange_strong(expect, s, std::memory_order_acq_rel, std::memory_order_acquire)) {
+            stripe_free(s);
+            return expect;
+        }
+        return s;
+    }
+
+private:
+    stripe                  base_;
+    std::atomic<stripe*>    stripes_    { nullptr };
+    std::atomic<uint64_t>   max_        { 0 };
+};
+
+};
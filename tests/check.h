@@ -0,0 +1,7 @@
+#pragma once
+
+#include <cstdio>
+#include <cstdlib>
+
+/* test assertion that stays on in release builds */
+#define CHECK(exp)  do { if (exp) break; std::fprintf(stderr, "[%s:%d] CHECK(%s) failed\n", __FILE__, __LINE__, #exp); std::exit(1); } while (0)
@@ -0,0 +1,178 @@
+#include <atomic>
+#include <cstdlib>
+#include <functional>
+#include <new>
+#include <vector>
+
+#include "awaitable.hpp"
+#include "check.h"
+
+/* counts heap allocations, resuming waiters must not make any */
+static std::atomic<size_t> allocations { 0 };
+
+__attribute__((noinline)) void* operator new(size_t size)
+{
+    ++allocations;
+    if (void* p = std::malloc(size ? size : 1)) {
+        return p;
+    }
+    throw std::bad_alloc();
+}
+
+__attribute__((noinline)) void operator delete(void* p) noexcept
+{
+    std::free(p);
+}
+
+__attribute__((noinline)) void operator delete(void* p, size_t) noexcept
+{
+    std::free(p);
+}
+
+/* fire and forget coroutine, the frame frees itself when the body ends */
+struct task
+{
+    struct promise_type
+    {
+        task get_return_object() { return task(); }
+        std::suspend_never initial_suspend() noexcept { return {}; }
+        std::suspend_never final_suspend() noexcept { return {}; }
+        void return_void() {}
+        void unhandled_exception() { std::abort(); }
+    };
+};
+
+/* only has post(fn), resumes when run() is called */
+struct queued_executor
+{
+    void post(std::function<void()> fn)
+    {
+        queue.push_back(std::move(fn));
+    }
+
+    void run()
+    {
+        while (!queue.empty()) {
+            std::function<void()> fn = std::move(queue.front());
+            queue.erase(queue.begin());
+            fn();
+        }
+    }
+
+    std::vector<std::function<void()> > queue;
+};
+
+template <typename Queue>
+static task consume(Queue& queue, std::vector<int>& got)
+{
+    got.push_back(co_await queue.pop());
+}
+
+template <typename Mutex>
+static task count_locked(Mutex& mutex, int& count)
+{
+    co_await mutex.lock_async();
+    ++count;
+    mutex.unlock();
+}
+
+static task read_locked(app::async_shared_mutex<>& mutex, app::async_queue<int>& release, int& readers)
+{
+    co_await mutex.lock_shared_async();
+    ++readers;
+    co_await release.pop();
+    --readers;
+    mutex.unlock_shared();
+}
+
+static task write_locked(app::async_shared_mutex<>& mutex, int& readers, int& writes)
+{
+    co_await mutex.lock_async();
+    CHECK(readers == 0);
+    ++writes;
+    mutex.unlock();
+}
+
+/* items go to the waiters in fifo order, or wait for a later pop */
+static void queue()
+{
+    app::async_queue<int> queue;
+    std::vector<int> got;
+    consume(queue, got);
+    consume(queue, got);
+    CHECK(got.empty());
+    queue.push(1);
+    queue.push(2);
+    queue.push(3);
+    CHECK(got == std::vector<int>({ 1, 2 }) && queue.size() == 1);
+    consume(queue, got);
+    CHECK(got.size() == 3 && got[2] == 3 && queue.size() == 0);
+}
+
+/* a long chain of waiters resumes in a loop without allocating */
+static void mutex_chain()
+{
+    const int waiters = 100000;
+    app::async_mutex<> mutex;
+    int count = 0;
+    CHECK(mutex.try_lock());
+    for (int i = 0; i < waiters; ++i) {
+        count_locked(mutex, count);
+    }
+    CHECK(count == 0);
+
+    size_t before = allocations;
+    mutex.unlock();
+    CHECK(allocations == before);
+    CHECK(count == waiters);
+    CHECK(mutex.try_lock());
+    mutex.unlock();
+}
+
+/* a release wakes the run of readers at the front or one writer */
+static void shared_mutex()
+{
+    app::async_shared_mutex<> mutex;
+    app::async_queue<int> release;
+    int readers = 0;
+    int writes = 0;
+    CHECK(mutex.try_lock());
+    read_locked(mutex, release, readers);
+    read_locked(mutex, release, readers);
+    write_locked(mutex, readers, writes);
+    read_locked(mutex, release, readers);
+    mutex.unlock();
+    CHECK(readers == 2 && writes == 0);
+    release.push(0);
+    CHECK(readers == 1 && writes == 0);
+    release.push(0);
+    CHECK(readers == 1 && writes == 1);
+    release.push(0);
+    CHECK(readers == 0);
+    CHECK(mutex.try_lock());
+    mutex.unlock();
+}
+
+/* an executor with only post() still works */
+static void post_executor()
+{
+    queued_executor exec;
+    app::async_mutex<queued_executor> mutex(exec);
+    int count = 0;
+    CHECK(mutex.try_lock());
+    count_locked(mutex, count);
+    count_locked(mutex, count);
+    mutex.unlock();
+    CHECK(count == 0 && exec.queue.size() == 1);
+    exec.run();
+    CHECK(count == 2);
+}
+
+int main()
+{
+    queue();
+    mutex_chain();
+    shared_mutex();
+    post_executor();
+    return 0;
+}
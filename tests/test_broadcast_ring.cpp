@@ -0,0 +1,66 @@
+#include <thread>
+#include <vector>
+#include <cstdint>
+
+#include "broadcast_ring.hpp"
+#include "check.h"
+
+/* every consumer sees every event once, per producer in order; a dependent
+ * consumer never passes the consumer it depends on */
+static void broadcast(app::wait_strategy strategy)
+{
+    const int producers = 2;
+    const int64_t items = 50000;
+    app::broadcast_ring<int64_t> ring(64, strategy);
+    auto& first = ring.add_consumer();
+    auto& second = ring.add_consumer();
+    auto& last = ring.add_consumer({ &first, &second });
+
+    std::vector<std::thread> threads;
+    auto consume = [&](app::broadcast_ring<int64_t>::consumer& c, const app::broadcast_ring<int64_t>::consumer* dep) {
+        std::vector<int64_t> next(producers, 0);
+        int64_t seen = 0;
+        while (seen < producers * items) {
+            seen += int64_t(c.wait_and_poll([&](const int64_t& ev, int64_t seq, bool) {
+                int p = int(ev % producers);
+                CHECK(ev / producers == next[p]);
+                ++next[p];
+                if (dep != nullptr) {
+                    CHECK(seq <= dep->cursor());
+                }
+            }));
+        }
+        CHECK(seen == producers * items);
+    };
+    threads.emplace_back([&]() { consume(first, nullptr); });
+    threads.emplace_back([&]() { consume(second, nullptr); });
+    threads.emplace_back([&]() { consume(last, &first); });
+
+    for (int p = 0; p < producers; ++p) {
+        threads.emplace_back([&, p]() {
+            for (int64_t i = 0; i < items; ++i) {
+                if (i % 2 == 0) {
+                    ring.push(i * producers + p);
+                    continue;
+                }
+                int64_t seq = ring.claim();
+                ring[seq] = i * producers + p;
+                ring.publish(seq);
+            }
+        });
+    }
+    for (auto& th : threads) {
+        th.join();
+    }
+    CHECK(last.cursor() == producers * items - 1);
+}
+
+int main()
+{
+    app::broadcast_ring<int> ring(100);
+    CHECK(ring.capacity() == 128);
+
+    broadcast(app::wait_strategy::yield);
+    broadcast(app::wait_strategy::block);
+    return 0;
+}
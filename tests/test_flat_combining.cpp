@@ -0,0 +1,46 @@
+#include <queue>
+#include <thread>
+#include <vector>
+#include <stdexcept>
+
+#include "flat_combining.hpp"
+#include "check.h"
+
+int main()
+{
+    app::flat_combining<std::priority_queue<int>, 4> pq;
+
+    // more threads than slots, every operation runs exactly once
+    std::vector<std::thread> threads;
+    for (int t = 0; t < 8; ++t) {
+        threads.emplace_back([&, t]() {
+            for (int i = 0; i < 5000; ++i) {
+                pq.apply([t, i](std::priority_queue<int>& q) { q.push(t * 5000 + i); });
+            }
+        });
+    }
+    for (auto& th : threads) {
+        th.join();
+    }
+    CHECK(pq.unsafe().size() == 40000);
+    CHECK(pq.operations() == 40000);
+    CHECK(pq.passes() > 0 && pq.passes() <= pq.operations());
+
+    int top = pq.apply([](std::priority_queue<int>& q) {
+        int v = q.top();
+        q.pop();
+        return v;
+    });
+    CHECK(top == 39999);
+
+    bool caught = false;
+    try {
+        pq.apply([](std::priority_queue<int>&) -> int { throw std::runtime_error("op"); });
+    }
+    catch (const std::runtime_error&) {
+        caught = true;
+    }
+    CHECK(caught);
+    CHECK(pq.apply([](std::priority_queue<int>& q) { return q.size(); }) == 39999);
+    return 0;
+}
@@ -0,0 +1,98 @@
+#define APP_LOCK_PROFILE 1
+
+#include <mutex>
+#include <chrono>
+#include <string>
+#include <thread>
+#include <sstream>
+
+#include "lock_profile.h"
+#include "shared_mutex.h"
+#include "check.h"
+
+/* every acquisition is counted, a blocked one as contended, names are escaped in json */
+static void profiled()
+{
+    app::lock_registry::instance().sample_rate(1);
+
+    app::profiled_lock<std::mutex> mtx("test \"quoted\"\n");
+    for (int i = 0; i < 100; ++i) {
+        mtx.lock();
+        mtx.unlock();
+    }
+    CHECK(mtx.try_lock());
+    mtx.unlock();
+    CHECK(mtx.stats().acquisitions() == 101);
+    CHECK(mtx.stats().contended() == 0);
+
+    mtx.lock();
+    std::thread waiter([&]() {
+        mtx.lock();
+        mtx.unlock();
+    });
+    std::this_thread::sleep_for(std::chrono::milliseconds(20));
+    mtx.unlock();
+    waiter.join();
+    CHECK(mtx.stats().acquisitions() == 103);
+    CHECK(mtx.stats().contended() == 1);
+    CHECK(mtx.stats().wait_histogram().max() > 0);
+    CHECK(mtx.stats().hold_histogram().max() > 0);
+
+    std::ostringstream json;
+    app::lock_registry::instance().dump_json(json);
+    CHECK(json.str().find("\"test \\\"quoted\\\"\\u000a\"") != std::string::npos);
+
+    std::ostringstream text;
+    app::lock_registry::instance().dump_text(text);
+    CHECK(text.str().find("acquisitions") != std::string::npos);
+}
+
+/* shared holds are timed per thread */
+static void shared()
+{
+    app::lock_registry::instance().sample_rate(1);
+    app::profiled_lock<app::shared_mutex> mtx("shared");
+    mtx.lock_shared();
+    std::this_thread::sleep_for(std::chrono::milliseconds(2));
+    mtx.unlock_shared();
+    CHECK(mtx.stats().acquisitions() == 1);
+    CHECK(mtx.stats().hold_histogram().max() >= 1000000);
+}
+
+static void counted()
+{
+    app::counted_lock<std::mutex> mtx;
+    mtx.lock();
+    std::thread waiter([&]() {
+        mtx.lock();
+        mtx.unlock();
+    });
+    std::this_thread::sleep_for(std::chrono::milliseconds(20));
+    mtx.unlock();
+    waiter.join();
+
+    std::lock_guard<app::counted_lock<std::mutex> > lck(mtx);
+    CHECK(mtx.acquisitions() == 3);
+    CHECK(mtx.contended() == 1);
+    CHECK(mtx.wait_ns() > 0 && mtx.wait_max_ns() == mtx.wait_ns());
+}
+
+static void histogram()
+{
+    app::lock_histogram hist;
+    for (uint64_t ns = 1; ns <= 1000; ++ns) {
+        hist.record(ns);
+    }
+    CHECK(hist.max() == 1000);
+    CHECK(hist.percentile(50) >= 500 && hist.percentile(50) <= 1024);
+    CHECK(hist.percentile(100) == 1000);
+}
+
+int main()
+{
+    profiled();
+    shared();
+    counted();
+    histogram();
+    return 0;
+}
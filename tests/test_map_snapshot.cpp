@@ -0,0 +1,67 @@
+#include <cstdio>
+#include <string>
+#include <fstream>
+
+#include "map_snapshot.hpp"
+#include "check.h"
+
+typedef app::unordered_map<uint64_t, double> map_type;
+
+int main()
+{
+    const std::string path = "test_map_snapshot.snap";
+
+    // strided keys, identity std::hash would put them all in one masked bucket
+    map_type map;
+    for (uint64_t i = 0; i < 50000; ++i) {
+        map.emplace(i << 16, double(i) / 2);
+    }
+    CHECK(app::write_snapshot(map, path));
+
+    app::map_snapshot<uint64_t, double> snap;
+    CHECK(snap.open(path));
+    CHECK(snap.size() == 50000);
+    double value;
+    for (uint64_t i = 0; i < 50000; ++i) {
+        CHECK(snap.find(i << 16, value) && value == double(i) / 2);
+    }
+    CHECK(!snap.find(1, value));
+    CHECK(snap.count(5 << 16) == 1 && snap.count(5) == 0);
+
+    map_type loaded;
+    loaded.emplace(uint64_t(7) << 16, -1.0);
+    CHECK(snap.load_into(loaded, 4) == 49999);
+    CHECK(loaded.size() == 50000);
+    CHECK(loaded.find(uint64_t(7) << 16, value) && value == -1.0);
+    CHECK(loaded.find(uint64_t(8) << 16, value) && value == 4.0);
+    snap.close();
+
+    // another value type, a truncated file and a corrupt offset table are refused
+    app::map_snapshot<uint64_t, float> wrong;
+    CHECK(!wrong.open(path));
+
+    std::string data;
+    {
+        std::ifstream in(path, std::ios::binary);
+        data.assign(std::istreambuf_iterator<char>(in), std::istreambuf_iterator<char>());
+    }
+    {
+        std::ofstream out(path, std::ios::binary | std::ios::trunc);
+        out.write(data.data(), std::streamsize(data.size() - 8));
+    }
+    CHECK(!snap.open(path));
+    {
+        std::string bad = data;
+        app::snapshot_header h;
+        std::memcpy(&h, bad.data(), sizeof(h));
+        uint64_t huge = ~uint64_t(0);
+        std::memcpy(&bad[size_t(h.offsets_pos) + sizeof(uint64_t)], &huge, sizeof(huge));
+        std::ofstream out(path, std::ios::binary | std::ios::trunc);
+        out.write(bad.data(), std::streamsize(bad.size()));
+    }
+    CHECK(!snap.open(path));
+    CHECK(!snap.open("test_map_snapshot.missing"));
+
+    std::remove(path.c_str());
+    return 0;
+}
@@ -0,0 +1,84 @@
+#include <chrono>
+#include <thread>
+#include <vector>
+
+#include "mpsc_queue.hpp"
+#include "check.h"
+
+struct msg : app::mpsc_hook
+{
+    int     producer;
+    int     seq;
+};
+
+/* per producer fifo through pop and drain_all, nothing lost or duplicated */
+static void fifo()
+{
+    const int producers = 4;
+    const int items = 20000;
+    std::vector<std::vector<msg> > msgs(producers, std::vector<msg>(items));
+    app::mailbox<msg> box;
+
+    std::vector<std::thread> threads;
+    for (int p = 0; p < producers; ++p) {
+        threads.emplace_back([&, p]() {
+            for (int i = 0; i < items; ++i) {
+                msgs[p][i].producer = p;
+                msgs[p][i].seq = i;
+                box.push(&msgs[p][i]);
+            }
+        });
+    }
+
+    std::vector<int> next(producers, 0);
+    int got = 0;
+    auto take = [&](msg* m) {
+        CHECK(m->seq == next[m->producer]);
+        ++next[m->producer];
+        ++got;
+    };
+    while (got < producers * items) {
+        if (got % 3 == 0) {
+            box.drain_all(take);
+            continue;
+        }
+        msg* m = box.try_pop();
+        if (m != nullptr) {
+            take(m);
+        }
+        else {
+            box.wait_for(std::chrono::milliseconds(1));
+        }
+    }
+    for (auto& th : threads) {
+        th.join();
+    }
+    CHECK(box.try_pop() == nullptr);
+    CHECK(box.drain_all(take) == 0);
+}
+
+static void parking()
+{
+    app::mailbox<msg> box;
+    msg m;
+    CHECK(!box.wait_for(std::chrono::milliseconds(1)));
+
+    std::thread producer([&]() {
+        std::this_thread::sleep_for(std::chrono::milliseconds(10));
+        box.push(&m);
+    });
+    CHECK(box.wait_and_pop() == &m);
+    producer.join();
+
+    // a popped node may be pushed again
+    box.push(&m);
+    CHECK(box.try_pop() == &m);
+    CHECK(box.try_pop() == nullptr);
+}
+
+int main()
+{
+    fifo();
+    parking();
+    return 0;
+}
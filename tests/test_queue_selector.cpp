@@ -0,0 +1,130 @@
+#include <atomic>
+#include <chrono>
+#include <thread>
+#include <vector>
+
+#include "safequeue.hpp"
+#include "check.h"
+
+static void priority()
+{
+    app::safe_queue<int> high;
+    app::safe_queue<int> low;
+    app::queue_selector selector(app::queue_selector::priority);
+    CHECK(selector.add(high) == 0);
+    CHECK(selector.add(low) == 1);
+
+    CHECK(selector.try_any() == -1);
+    CHECK(selector.wait_any(std::chrono::milliseconds(5)) == -1);
+
+    low.push(1);
+    high.push(2);
+    CHECK(selector.wait_any() == 0);
+    int val;
+    CHECK(high.try_pop(val) && val == 2);
+    CHECK(selector.wait_any() == 1);
+    CHECK(low.try_pop(val) && val == 1);
+
+    std::thread producer([&]() {
+        std::this_thread::sleep_for(std::chrono::milliseconds(10));
+        low.push(3);
+    });
+    CHECK(selector.wait_any() == 1);
+    producer.join();
+    CHECK(low.try_pop(val) && val == 3);
+}
+
+static void weighted()
+{
+    app::safe_queue<int> a;
+    app::safe_queue<int> b;
+    app::queue_selector selector(app::queue_selector::weighted);
+    selector.add(a, 3);
+    selector.add(b, 1);
+    for (int i = 0; i < 400; ++i) {
+        a.push(i);
+        b.push(i);
+    }
+
+    int picked[2] = { 0, 0 };
+    int val;
+    for (int i = 0; i < 400; ++i) {
+        int idx = selector.wait_any();
+        CHECK(idx == 0 || idx == 1);
+        ++picked[idx];
+        CHECK((idx == 0 ? a : b).try_pop(val));
+    }
+    CHECK(picked[0] == 300 && picked[1] == 100);
+}
+
+/* dispatchers blocked on the selector get every item of several producers */
+static void dispatch()
+{
+    const int producers = 3;
+    const int items = 20000;
+    app::safe_queue<int> queues[producers];
+    app::queue_selector selector;
+    for (auto& q : queues) {
+        selector.add(q);
+    }
+
+    std::atomic<int> got { 0 };
+    std::vector<std::thread> threads;
+    for (int d = 0; d < 2; ++d) {
+        threads.emplace_back([&]() {
+            while (got.load() < producers * items) {
+                int idx = selector.wait_any(std::chrono::milliseconds(50));
+                int val;
+                if (idx >= 0 && queues[idx].try_pop(val)) {
+                    ++got;
+                }
+            }
+        });
+    }
+    for (int p = 0; p < producers; ++p) {
+        threads.emplace_back([&, p]() {
+            for (int i = 0; i < items; ++i) {
+                queues[p].push(i);
+            }
+        });
+    }
+    for (auto& th : threads) {
+        th.join();
+    }
+    CHECK(got == producers * items);
+}
+
+/* a queue destroyed before the selector detaches itself and is never picked again */
+static void lifetime()
+{
+    app::safe_queue<int> kept;
+    app::queue_selector selector;
+    {
+        app::safe_queue<int> gone;
+        CHECK(selector.add(gone) == 0);
+        CHECK(selector.add(kept) == 1);
+        gone.push(1);
+        CHECK(selector.try_any() == 0);
+    }
+    CHECK(selector.try_any() == -1);
+    kept.push(2);
+    CHECK(selector.wait_any() == 1);
+
+    // the selector goes first, later pushes do not touch it
+    {
+        app::queue_selector other;
+        other.add(kept);
+    }
+    kept.push(3);
+    int val;
+    CHECK(kept.try_pop(val) && val == 2);
+}
+
+int main()
+{
+    priority();
+    weighted();
+    dispatch();
+    lifetime();
+    return 0;
+}
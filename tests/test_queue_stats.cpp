@@ -0,0 +1,45 @@
+#include <chrono>
+#include <thread>
+
+#include "queue_stats.hpp"
+#include "check.h"
+
+int main()
+{
+    app::monitored_queue<int> queue("stats", 1);
+    for (int i = 0; i < 100; ++i) {
+        queue.push(i);
+    }
+    std::this_thread::sleep_for(std::chrono::milliseconds(1));
+
+    int val;
+    for (int i = 0; i < 100; ++i) {
+        CHECK(queue.try_pop(val) && val == i);
+    }
+    CHECK(!queue.try_pop(val));
+
+    std::thread producer([&]() {
+        std::this_thread::sleep_for(std::chrono::milliseconds(10));
+        queue.push(7);
+    });
+    queue.wait_and_pop(val);
+    producer.join();
+    CHECK(val == 7);
+    CHECK(!queue.wait_and_pop(val, std::chrono::milliseconds(1)));
+
+    app::queue_snapshot snap = queue.stats();
+    CHECK(snap.depth == 0);
+    CHECK(snap.high_watermark == 100);
+    CHECK(snap.pushes == 101 && snap.pops == 101);
+    CHECK(snap.sojourn_max_ns >= 1000000);
+    CHECK(snap.sojourn_p50_ns > 0 && snap.sojourn_p50_ns <= snap.sojourn_max_ns);
+    CHECK(snap.idle_ns >= 5000000);
+    CHECK(snap.push_rate > 0);
+
+    app::monitored_queue<int, app::safe_priorqueue> prio;
+    prio.push(1);
+    prio.push(3);
+    prio.push(2);
+    CHECK(prio.try_pop(val) && val == 3);
+    return 0;
+}
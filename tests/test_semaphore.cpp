@@ -0,0 +1,101 @@
+#include <atomic>
+#include <chrono>
+#include <thread>
+#include <vector>
+
+#include "semaphore.hpp"
+#include "check.h"
+
+static void counting()
+{
+    app::semaphore sem(2);
+    std::atomic<int> inside { 0 };
+    std::vector<std::thread> threads;
+    for (int t = 0; t < 4; ++t) {
+        threads.emplace_back([&]() {
+            for (int i = 0; i < 2000; ++i) {
+                sem.acquire();
+                CHECK(inside.fetch_add(1) < 2);
+                inside.fetch_sub(1);
+                sem.release();
+            }
+        });
+    }
+    for (auto& th : threads) {
+        th.join();
+    }
+    CHECK(sem.available() == 2);
+
+    CHECK(sem.try_acquire() && sem.try_acquire() && !sem.try_acquire());
+    CHECK(!sem.try_acquire_for(std::chrono::milliseconds(5)));
+    std::thread releaser([&]() {
+        std::this_thread::sleep_for(std::chrono::milliseconds(10));
+        sem.release(2);
+    });
+    sem.acquire();
+    CHECK(sem.try_acquire_for(std::chrono::milliseconds(1000)));
+    releaser.join();
+    CHECK(sem.available() == 0);
+}
+
+static void countdown()
+{
+    app::latch done(4);
+    std::atomic<int> work { 0 };
+    std::vector<std::thread> threads;
+    for (int t = 0; t < 4; ++t) {
+        threads.emplace_back([&]() {
+            ++work;
+            done.count_down();
+        });
+    }
+    done.wait();
+    CHECK(work == 4 && done.try_wait());
+    for (auto& th : threads) {
+        th.join();
+    }
+}
+
+/* no thread starts phase n + 1 before every thread finished phase n */
+static void phases()
+{
+    const int threads = 4;
+    const int rounds = 200;
+    std::atomic<int> arrived { 0 };
+    int completions = 0;
+    app::barrier sync(threads, [&]() {
+        CHECK(arrived.load() % threads == 0);
+        ++completions;
+    });
+
+    std::vector<std::thread> workers;
+    std::atomic<int> completers { 0 };
+    for (int t = 0; t < threads; ++t) {
+        workers.emplace_back([&, t]() {
+            for (int r = 0; r < rounds; ++r) {
+                ++arrived;
+                if (sync.arrive_and_wait()) {
+                    ++completers;
+                }
+                CHECK(arrived.load() >= (r + 1) * threads);
+            }
+            if (t == 0) {
+                sync.arrive_and_drop();
+            }
+        });
+    }
+    for (auto& th : workers) {
+        th.join();
+    }
+    CHECK(completions == rounds);
+    CHECK(completers == rounds);
+    CHECK(sync.generation() == uint32_t(rounds));
+}
+
+int main()
+{
+    counting();
+    countdown();
+    phases();
+    return 0;
+}
@@ -0,0 +1,83 @@
+#include <atomic>
+#include <thread>
+#include <vector>
+#include <cstdint>
+
+#include "seqlock.h"
+#include "check.h"
+
+struct pair_value
+{
+    uint64_t    a;
+    uint64_t    b;
+    uint64_t    c;
+};
+
+/* readers never see a torn value while a writer keeps storing */
+static void torn()
+{
+    app::seqlock<pair_value> value;
+    std::atomic<bool> stop { false };
+
+    std::thread writer([&]() {
+        for (uint64_t i = 1; i <= 200000; ++i) {
+            value.store(pair_value { i, i * 2, i * 3 });
+        }
+        value.update([](pair_value& v) { ++v.a; v.b = v.a * 2; v.c = v.a * 3; });
+        stop = true;
+    });
+
+    std::vector<std::thread> readers;
+    for (int t = 0; t < 2; ++t) {
+        readers.emplace_back([&]() {
+            uint64_t last = 0;
+            while (!stop) {
+                pair_value v = value.load();
+                CHECK(v.b == v.a * 2 && v.c == v.a * 3);
+                CHECK(v.a >= last);
+                last = v.a;
+            }
+        });
+    }
+    writer.join();
+    for (auto& r : readers) {
+        r.join();
+    }
+
+    pair_value v = value.load();
+    CHECK(v.a == 200001 && v.b == 400002 && v.c == 600003);
+    CHECK(value.sequence() % 2 == 0);
+}
+
+/* seq_lock around plain data: read() retries until it saw no writer */
+static void guard()
+{
+    app::seq_lock lock;
+    std::atomic<uint64_t> x { 0 };
+    std::atomic<uint64_t> y { 0 };
+
+    std::thread writer([&]() {
+        for (uint64_t i = 1; i <= 100000; ++i) {
+            lock.lock();
+            x.store(i, std::memory_order_relaxed);
+            y.store(i, std::memory_order_relaxed);
+            lock.unlock();
+        }
+    });
+    for (int i = 0; i < 100000; ++i) {
+        bool same = lock.read([&]() { return x.load(std::memory_order_relaxed) == y.load(std::memory_order_relaxed); });
+        CHECK(same);
+    }
+    writer.join();
+
+    CHECK(lock.try_lock());
+    CHECK(!lock.try_lock());
+    lock.unlock();
+}
+
+int main()
+{
+    torn();
+    guard();
+    return 0;
+}
@@ -0,0 +1,246 @@
+#include <atomic>
+#include <chrono>
+#include <thread>
+#include <vector>
+
+#include "shared_mutex.h"
+#include "check.h"
+
+/* exposes the waiter counts so a test can wait until a thread is really blocked */
+template <typename Policy>
+struct probe_mutex : app::basic_shared_mutex<Policy>
+{
+    size_t waiting_writers()
+    {
+        std::lock_guard<std::mutex> lck(this->mtx_);
+        return this->wait_w_;
+    }
+};
+
+template <typename Mutex>
+static void wait_for_writer(Mutex& mtx)
+{
+    while (mtx.waiting_writers() == 0) {
+        std::this_thread::yield();
+    }
+}
+
+/* writers are exclusive, readers never see a writer inside */
+template <typename Policy>
+static void exclusion()
+{
+    app::basic_shared_mutex<Policy> mtx;
+    std::atomic<int> writers { 0 };
+    std::atomic<int> readers { 0 };
+    long value = 0;
+
+    std::vector<std::thread> threads;
+    for (int t = 0; t < 4; ++t) {
+        threads.emplace_back([&, t]() {
+            for (int i = 0; i < 2000; ++i) {
+                if ((i + t) % 4 == 0) {
+                    mtx.lock();
+                    CHECK(writers.fetch_add(1) == 0 && readers.load() == 0);
+                    ++value;
+                    writers.fetch_sub(1);
+                    mtx.unlock();
+                }
+                else {
+                    mtx.lock_shared();
+                    readers.fetch_add(1);
+                    CHECK(writers.load() == 0);
+                    readers.fetch_sub(1);
+                    mtx.unlock_shared();
+                }
+            }
+        });
+    }
+    for (auto& th : threads) {
+        th.join();
+    }
+    CHECK(value == 4 * 500);
+}
+
+/* recursive reads, a writer reading, a sole reader promoting through lock() */
+template <typename Policy>
+static void recursion()
+{
+    app::basic_shared_mutex<Policy> mtx;
+    mtx.lock_shared();
+    mtx.lock_shared();
+    mtx.unlock_shared();
+    mtx.unlock_shared();
+
+    mtx.lock();
+    mtx.lock_shared();
+    mtx.unlock_shared();
+    mtx.unlock();
+
+    mtx.lock_shared();
+    mtx.lock();
+    mtx.unlock();
+    mtx.unlock_shared();
+    CHECK(mtx.try_lock());
+    mtx.unlock();
+}
+
+/* a waiting writer holds off new readers under writer_prefer, not under reader_prefer */
+static void preference()
+{
+    {
+        probe_mutex<app::writer_prefer_policy> mtx;
+        mtx.lock_shared();
+        std::thread writer([&]() { mtx.lock(); mtx.unlock(); });
+        wait_for_writer(mtx);
+        std::thread reader([&]() { CHECK(!mtx.try_lock_shared()); });
+        reader.join();
+        mtx.unlock_shared();
+        writer.join();
+    }
+    {
+        probe_mutex<app::reader_prefer_policy> mtx;
+        mtx.lock_shared();
+        std::thread writer([&]() { mtx.lock(); mtx.unlock(); });
+        wait_for_writer(mtx);
+        std::thread reader([&]() {
+            CHECK(mtx.try_lock_shared());
+            mtx.unlock_shared();
+        });
+        reader.join();
+        mtx.unlock_shared();
+        writer.join();
+    }
+}
+
+/* the upgrader coexists with readers, excludes writers and a second upgrader */
+static void upgrade()
+{
+    app::shared_mutex mtx;
+    mtx.lock_upgrade();
+
+    std::thread other([&]() {
+        CHECK(mtx.try_lock_shared());
+        CHECK(!mtx.try_lock());
+        CHECK(!mtx.try_lock_upgrade());
+        mtx.unlock_shared();
+    });
+    other.join();
+
+    std::atomic<bool> reading { false };
+    std::atomic<bool> release { false };
+    std::thread reader([&]() {
+        mtx.lock_shared();
+        reading = true;
+        while (!release) {
+            std::this_thread::yield();
+        }
+        mtx.unlock_shared();
+    });
+    while (!reading) {
+        std::this_thread::yield();
+    }
+    CHECK(!mtx.try_upgrade());
+    release = true;
+    CHECK(mtx.upgrade_to_unique());
+    reader.join();
+
+    std::thread blocked([&]() { CHECK(!mtx.try_lock_shared()); });
+    blocked.join();
+
+    mtx.downgrade();
+    std::thread after([&]() {
+        CHECK(mtx.try_lock_shared());
+        mtx.unlock_shared();
+    });
+    after.join();
+    mtx.unlock_upgrade();
+    CHECK(mtx.try_lock());
+    mtx.unlock();
+}
+
+/* a sole reader promoting through lock() waits for the upgrade lock and gets it when
+ * the upgrader leaves; an upgrade racing with it gives way instead of deadlocking */
+static void promote_while_upgrading()
+{
+    probe_mutex<app::writer_prefer_policy> mtx;
+    std::atomic<bool> promoted { false };
+    auto promoter = [&]() {
+        mtx.lock_shared();
+        mtx.lock();
+        promoted = true;
+        mtx.unlock();
+        mtx.unlock_shared();
+    };
+
+    // the upgrader only reads and leaves
+    mtx.lock_upgrade();
+    std::thread reader(promoter);
+    wait_for_writer(mtx);
+    CHECK(!promoted);
+    mtx.unlock_upgrade();
+    reader.join();
+    CHECK(promoted);
+
+    // the upgrader tries to write after the reader started waiting
+    promoted = false;
+    mtx.lock_upgrade();
+    reader = std::thread(promoter);
+    wait_for_writer(mtx);
+    CHECK(!mtx.upgrade_to_unique());
+    mtx.unlock_upgrade();
+    reader.join();
+    CHECK(promoted);
+
+    // the upgrader already waits for the reader when it tries to promote
+    promoted = false;
+    std::atomic<bool> reading { false };
+    std::atomic<bool> promote { false };
+    reader = std::thread([&]() {
+        mtx.lock_shared();
+        reading = true;
+        while (!promote) {
+            std::this_thread::yield();
+        }
+        mtx.lock();
+        promoted = true;
+        mtx.unlock();
+        mtx.unlock_shared();
+    });
+    while (!reading) {
+        std::this_thread::yield();
+    }
+    mtx.lock_upgrade();
+    std::atomic<bool> upgraded { true };
+    std::thread release([&]() {
+        // let the reader promote once the main thread waits in upgrade_to_unique
+        while (mtx.waiting_writers() == 0) {
+            std::this_thread::yield();
+        }
+        promote = true;
+    });
+    upgraded = mtx.upgrade_to_unique();
+    release.join();
+    CHECK(!upgraded);
+    mtx.unlock_upgrade();
+    reader.join();
+    CHECK(promoted);
+
+    mtx.lock_upgrade();
+    CHECK(mtx.upgrade_to_unique());
+    mtx.downgrade();
+    mtx.unlock_upgrade();
+}
+
+int main()
+{
+    exclusion<app::writer_prefer_policy>();
+    exclusion<app::reader_prefer_policy>();
+    exclusion<app::phase_fair_policy>();
+    recursion<app::writer_prefer_policy>();
+    recursion<app::reader_prefer_policy>();
+    recursion<app::phase_fair_policy>();
+    preference();
+    upgrade();
+    promote_while_upgrading();
+    return 0;
+}
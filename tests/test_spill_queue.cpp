@@ -0,0 +1,165 @@
+#include <cstdio>
+#include <string>
+#include <thread>
+#include <vector>
+#include <cstdlib>
+#include <fstream>
+
+#include <dirent.h>
+
+#include "spill_queue.hpp"
+#include "check.h"
+
+struct item
+{
+    int     producer;
+    int     seq;
+};
+
+static const char* dir = "test_spill_queue.dir";
+
+static std::string text(int i)
+{
+    return std::string(size_t(i % 200), char('a' + i % 26)) + std::to_string(i);
+}
+
+/* per producer fifo while items move through memory and disk */
+static void fifo()
+{
+    app::spill_options opt;
+    opt.dir = dir;
+    opt.memory_items = 1000;
+    opt.segment_bytes = 64 * 1024;
+
+    app::spill_queue<item> queue(opt);
+    CHECK(queue.error() == 0);
+    const int producers = 4;
+    const int items = 20000;
+    std::vector<std::thread> threads;
+    for (int p = 0; p < producers; ++p) {
+        threads.emplace_back([&, p]() {
+            for (int i = 0; i < items; ++i) {
+                queue.push(item { p, i });
+            }
+        });
+    }
+
+    std::vector<int> next(producers, 0);
+    for (int got = 0; got < producers * items; ++got) {
+        item it;
+        queue.wait_and_pop(it);
+        CHECK(it.seq == next[it.producer]);
+        ++next[it.producer];
+    }
+    for (auto& th : threads) {
+        th.join();
+    }
+    CHECK(queue.empty() && queue.spilled() == 0);
+}
+
+/* spilled items survive a reopen, a corrupt record cuts its segment short */
+static void recovery()
+{
+    app::spill_options opt;
+    opt.dir = dir;
+    opt.memory_items = 0;
+    opt.segment_bytes = 8192;
+    {
+        app::spill_queue<std::string> queue(opt);
+        for (int i = 0; i < 3000; ++i) {
+            queue.push(text(i));
+        }
+        std::string s;
+        for (int i = 0; i < 500; ++i) {
+            CHECK(queue.try_pop(s) && s == text(i));
+        }
+        CHECK(queue.sync());
+    }
+    {
+        app::spill_queue<std::string> queue(opt);
+        CHECK(queue.size() == 2500);
+        std::string s;
+        for (int i = 500; i < 1000; ++i) {
+            CHECK(queue.try_pop(s) && s == text(i));
+        }
+        CHECK(queue.sync());
+    }
+
+    // the newest segment gets a record length running past its data at read_pos
+    struct header
+    {
+        uint32_t    magic;
+        uint32_t    version;
+        uint64_t    seq;
+        uint64_t    read_pos;
+        uint64_t    write_pos;
+        uint64_t    count;
+    };
+    std::string newest;
+    header last = header();
+    DIR* d = ::opendir(dir);
+    CHECK(d != nullptr);
+    for (struct dirent* ent = ::readdir(d); ent != nullptr; ent = ::readdir(d)) {
+        std::string path = std::string(dir) + "/" + ent->d_name;
+        header h = header();
+        std::ifstream(path, std::ios::binary).read(reinterpret_cast<char*>(&h), sizeof(h));
+        if (h.magic == 0x4c505341 && h.count > 0 && (newest.empty() || h.seq > last.seq)) {
+            newest = path;
+            last = h;
+        }
+    }
+    ::closedir(d);
+    CHECK(!newest.empty() && last.count < 2000);
+    {
+        std::fstream fs(newest, std::ios::in | std::ios::out | std::ios::binary);
+        uint32_t len = 0x7fffffff;
+        fs.seekp(std::streamoff(last.read_pos));
+        fs.write(reinterpret_cast<const char*>(&len), sizeof(len));
+    }
+    {
+        app::spill_queue<std::string> queue(opt);
+        CHECK(queue.size() == 2000 - last.count);
+        std::string s;
+        int i = 1000;
+        for (; queue.try_pop(s); ++i) {
+            CHECK(s == text(i));
+        }
+        CHECK(uint64_t(i) == 3000 - last.count);
+    }
+}
+
+/* a missing directory is created, one that cannot be keeps items in memory */
+static void errors()
+{
+    std::string nested = std::string(dir) + "/nested";
+    app::spill_options opt;
+    opt.dir = nested;
+    opt.memory_items = 0;
+    {
+        app::spill_queue<int> queue(opt);
+        CHECK(queue.error() == 0);
+        queue.push(1);
+        CHECK(queue.spilled() == 1);
+    }
+
+    opt.dir = std::string(dir) + "/file/sub";
+    std::ofstream(std::string(dir) + "/file") << "x";
+    app::spill_queue<int> queue(opt);
+    CHECK(queue.error() != 0);
+    for (int i = 0; i < 100; ++i) {
+        queue.push(i);
+    }
+    CHECK(queue.size() == 100 && queue.spilled() == 0);
+    int val;
+    CHECK(queue.try_pop(val) && val == 0);
+}
+
+int main()
+{
+    std::system((std::string("rm -rf ") + dir).c_str());
+    fifo();
+    recovery();
+    errors();
+    std::system((std::string("rm -rf ") + dir).c_str());
+    return 0;
+}
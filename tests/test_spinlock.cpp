@@ -0,0 +1,91 @@
+#include <atomic>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+#include "spinlock.h"
+#include "check.h"
+
+template <typename Lock>
+static void exclusive()
+{
+    Lock lock;
+    long value = 0;
+    std::vector<std::thread> threads;
+    for (int t = 0; t < 4; ++t) {
+        threads.emplace_back([&]() {
+            for (int i = 0; i < 20000; ++i) {
+                std::lock_guard<Lock> lck(lock);
+                ++value;
+            }
+        });
+    }
+    for (auto& th : threads) {
+        th.join();
+    }
+    CHECK(value == 4 * 20000);
+}
+
+/* readers share, writers exclude, a pending writer turns new readers away */
+static void rw()
+{
+    app::rw_spin_lock lock;
+    std::atomic<int> writers { 0 };
+    long value = 0;
+
+    std::vector<std::thread> threads;
+    for (int t = 0; t < 4; ++t) {
+        threads.emplace_back([&, t]() {
+            for (int i = 0; i < 20000; ++i) {
+                if (i % 8 == t) {
+                    lock.lock();
+                    CHECK(writers.fetch_add(1) == 0);
+                    ++value;
+                    writers.fetch_sub(1);
+                    lock.unlock();
+                }
+                else {
+                    lock.lock_shared();
+                    CHECK(writers.load() == 0);
+                    lock.unlock_shared();
+                }
+            }
+        });
+    }
+    for (auto& th : threads) {
+        th.join();
+    }
+    CHECK(value == 4 * 2500);
+
+    lock.lock_shared();
+    CHECK(lock.try_lock_shared());
+    lock.unlock_shared();
+    CHECK(!lock.try_lock());
+
+    std::atomic<bool> done { false };
+    std::thread writer([&]() {
+        lock.lock();
+        done = true;
+        lock.unlock();
+    });
+    // the writer marks itself pending, then new readers back off
+    while (lock.try_lock_shared()) {
+        lock.unlock_shared();
+        std::this_thread::yield();
+    }
+    CHECK(!done);
+    lock.unlock_shared();
+    writer.join();
+    CHECK(done);
+    CHECK(lock.try_lock_shared());
+    lock.unlock_shared();
+}
+
+int main()
+{
+    exclusive<app::spin_lock>();
+    exclusive<app::spin_mutex>();
+    exclusive<app::rw_spin_lock>();
+    rw();
+    return 0;
+}
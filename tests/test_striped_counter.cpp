@@ -0,0 +1,89 @@
+#include <thread>
+#include <vector>
+#include <cstdint>
+
+#include "striped_counter.hpp"
+#include "check.h"
+
+static_assert(alignof(app::striped_counter) == 64, "striped_counter is line aligned");
+static_assert(alignof(app::striped_histogram) == 64, "striped_histogram is line aligned");
+
+static void counter()
+{
+    app::striped_counter count;
+    std::vector<std::thread> threads;
+    for (int t = 0; t < 4; ++t) {
+        threads.emplace_back([&]() {
+            for (int i = 0; i < 50000; ++i) {
+                count.inc();
+            }
+            count -= 10;
+        });
+    }
+    for (auto& th : threads) {
+        th.join();
+    }
+    CHECK(count.read() == 4 * 50000 - 40);
+
+    app::striped_counter copy(count);
+    CHECK(copy.read() == count.read());
+    CHECK(count.read_and_reset() == 4 * 50000 - 40);
+    CHECK(count.read() == 0);
+    copy += 40;
+    CHECK(copy.read() == 4 * 50000);
+}
+
+static void histogram()
+{
+    app::striped_histogram hist;
+    std::vector<std::thread> threads;
+    for (int t = 0; t < 4; ++t) {
+        threads.emplace_back([&]() {
+            for (uint64_t v = 1; v <= 1000; ++v) {
+                hist.record(v);
+            }
+        });
+    }
+    for (auto& th : threads) {
+        th.join();
+    }
+
+    app::histogram_snapshot snap = hist.read();
+    CHECK(snap.count == 4000);
+    CHECK(snap.sum == 4 * 500500);
+    CHECK(snap.max == 1000);
+    CHECK(snap.mean() == 500.5);
+    CHECK(snap.percentile(50) >= 500 && snap.percentile(50) <= 1024);
+    CHECK(snap.percentile(100) == 1000);
+
+    app::striped_histogram copy(hist);
+    CHECK(copy.read().count == 4000 && copy.read().sum == snap.sum);
+    hist.reset();
+    CHECK(hist.read().count == 0 && hist.read().sum == 0);
+
+    // threads on disjoint buckets still share the sum, none of it may be lost
+    threads.clear();
+    for (int t = 0; t < 4; ++t) {
+        threads.emplace_back([&, t]() {
+            for (int i = 0; i < 50000; ++i) {
+                hist.record(uint64_t(1) << (4 * t));
+            }
+        });
+    }
+    for (auto& th : threads) {
+        th.join();
+    }
+    snap = hist.read();
+    CHECK(snap.count == 4 * 50000);
+    CHECK(snap.sum == 50000 * (1 + 16 + 256 + 4096));
+    for (int t = 0; t < 4; ++t) {
+        CHECK(snap.counts[4 * t] == 50000);
+    }
+}
+
+int main()
+{
+    counter();
+    histogram();
+    return 0;
+}
@@ -0,0 +1,73 @@
+#include <atomic>
+#include <stdexcept>
+#include <vector>
+
+#include "thread_pool.hpp"
+#include "check.h"
+
+static void deque()
+{
+    app::ws_deque<int*> dq(2);
+    std::vector<int> values(100);
+    for (auto& v : values) {
+        dq.push(&v);
+    }
+    CHECK(dq.steal() == &values[0]);
+    CHECK(dq.pop() == &values[99]);
+    for (int i = 98; i > 0; --i) {
+        CHECK(dq.pop() == &values[i]);
+    }
+    CHECK(dq.pop() == nullptr && dq.steal() == nullptr && dq.empty());
+}
+
+int main()
+{
+    deque();
+
+    app::thread_pool pool(4);
+    CHECK(pool.size() == 4);
+
+    std::atomic<long> sum { 0 };
+    pool.parallel_for(0, 100000, [&](size_t i) { sum += long(i); });
+    CHECK(sum == 100000L * 99999 / 2);
+
+    // an exception in a chunk reaches the caller once every chunk is done
+    for (int rep = 0; rep < 20; ++rep) {
+        bool caught = false;
+        try {
+            pool.parallel_for(0, 1000, [](size_t i) {
+                if (i % 97 == 5) {
+                    throw std::runtime_error("chunk");
+                }
+            });
+        }
+        catch (const std::runtime_error&) {
+            caught = true;
+        }
+        CHECK(caught);
+    }
+
+    auto nested = pool.submit([&pool]() {
+        std::atomic<int> n { 0 };
+        pool.parallel_for(0, 1000, [&n](size_t) { ++n; });
+        return n.load();
+    });
+    CHECK(nested.get() == 1000);
+
+    // submits from outside the pool wake idle workers
+    for (int i = 0; i < 2000; ++i) {
+        auto f = pool.submit([](int x) { return x * 2; }, i);
+        CHECK(f.get() == i * 2);
+    }
+
+    auto failing = pool.submit([]() -> int { throw std::logic_error("task"); });
+    bool caught = false;
+    try {
+        failing.get();
+    }
+    catch (const std::logic_error&) {
+        caught = true;
+    }
+    CHECK(caught);
+    return 0;
+}
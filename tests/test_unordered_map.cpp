@@ -0,0 +1,180 @@
+#include <atomic>
+#include <string>
+#include <thread>
+#include <type_traits>
+#include <vector>
+#include <utility>
+
+#include "unordered_map.hpp"
+#include "read_cache.hpp"
+#include "check.h"
+
+typedef app::unordered_map<int, int> int_map;
+
+/* every key lands in one bucket */
+struct flood_hash
+{
+    size_t operator()(int) const { return 42; }
+};
+
+static void stats()
+{
+    int_map map;
+    for (int i = 0; i < 10000; ++i) {
+        map.emplace(i, i);
+    }
+    app::unordered_map_stats st = map.stats();
+    CHECK(st.size == 10000);
+    CHECK(st.bucket_count >= 10000);
+    size_t walked = 0;
+    for (size_t n : st.bucket_sizes) {
+        walked += n;
+    }
+    CHECK(walked == st.bucket_count);
+    CHECK(st.max_chain >= 1 && st.max_chain < 8);
+    CHECK(st.rehashes > 0);
+    CHECK(st.lock_acquisitions >= 10000);
+    CHECK(!st.load_history.empty());
+
+    app::unordered_map_stats sampled = map.stats(64);
+    walked = 0;
+    for (size_t n : sampled.bucket_sizes) {
+        walked += n;
+    }
+    CHECK(walked >= 64 && walked < st.bucket_count);
+
+    // the public lock type is unchanged, taking it is still counted
+    static_assert(std::is_same<int_map::lock, std::unique_lock<std::recursive_mutex> >::value, "int_map::lock");
+    uint64_t before = map.stats().lock_acquisitions;
+    {
+        int_map::lock lck = map.get_lock();
+        CHECK(lck.owns_lock());
+    }
+    CHECK(map.stats().lock_acquisitions == before + 2);
+
+    app::unordered_map<int, int, flood_hash> flooded;
+    for (int i = 0; i < 1000; ++i) {
+        flooded.emplace(i, i);
+    }
+    CHECK(flooded.stats().max_chain == 1000);
+}
+
+/* same result as a serial insert, the first of equal keys wins */
+static void build()
+{
+    std::vector<std::pair<int, int> > input;
+    for (int i = 0; i < 200000; ++i) {
+        input.emplace_back(i % 150000, i);
+    }
+
+    int_map serial;
+    CHECK(serial.parallel_build(input.begin(), input.end(), 1) == 150000);
+    for (size_t threads : { 2, 4, 7 }) {
+        int_map map;
+        map.emplace(3, -3);
+        CHECK(map.parallel_build(input.begin(), input.end(), threads) == 149999);
+        CHECK(map.size() == 150000);
+        int value;
+        CHECK(map.find(3, value) && value == -3);
+        for (int i = 0; i < 150000; i += 997) {
+            CHECK(map.find(i, value) && (i == 3 || value == i));
+        }
+    }
+
+    int_map other;
+    for (int i = 100000; i < 300000; ++i) {
+        other.emplace(i, -i);
+    }
+    CHECK(serial.parallel_merge(other, 4) == 150000);
+    CHECK(serial.size() == 300000);
+    int value;
+    CHECK(serial.find(120000, value) && value == 120000);
+    CHECK(serial.find(250000, value) && value == -250000);
+    CHECK(serial.parallel_merge(serial) == 0);
+}
+
+/* cached hits until a write to the key's shard */
+static void cache()
+{
+    int_map map;
+    for (int i = 0; i < 100; ++i) {
+        map.emplace(i, i);
+    }
+
+    app::read_cache<int_map> cache(map);
+    int value;
+    CHECK(cache.find(5, value) && value == 5);
+    CHECK(cache.find(5, value) && value == 5);
+    CHECK(cache.hits() == 1 && cache.misses() == 1);
+    CHECK(!cache.find(1000, value));
+
+    map.assign(5, 50);
+    CHECK(cache.find(5, value) && value == 50);
+    CHECK(map.replace(5, 50, 51) && !map.replace(5, 50, 52));
+    CHECK(cache.find(5, value) && value == 51);
+    CHECK(*map.replace(5, 53) == 51);
+    CHECK(cache.find(5, value) && value == 53);
+    map.erase(5);
+    CHECK(!cache.find(5, value));
+
+    CHECK(cache.find(6, value) && value == 6);
+    {
+        auto lck = map.get_lock();
+        map[6] = 60;
+    }
+    CHECK(cache.find(6, value) && value == 60);
+    map[6] = 61;
+    CHECK(cache.find(6, value) && value == 61);
+
+    // reading through at() drops nothing
+    CHECK(cache.find(9, value));
+    uint64_t hits = cache.hits();
+    CHECK(map.at(9) == 9);
+    CHECK(cache.find(9, value) && cache.hits() == hits + 1);
+
+    // a value behind another thread's operator[] reference is not cached until it calls again
+    std::atomic<int> step { 0 };
+    std::thread slow([&]() {
+        int& ref = map[8];
+        step = 1;
+        while (step != 2) {
+            std::this_thread::yield();
+        }
+        ref = 80;
+        map.size();
+        step = 3;
+    });
+    while (step != 1) {
+        std::this_thread::yield();
+    }
+    uint64_t misses = cache.misses();
+    CHECK(cache.find(8, value) && value == 8);
+    CHECK(cache.find(8, value) && value == 8);
+    CHECK(cache.misses() == misses + 2);
+    step = 2;
+    slow.join();
+    CHECK(cache.find(8, value) && value == 80);
+    CHECK(cache.find(8, value) && value == 80 && cache.misses() == misses + 3);
+
+    std::thread writer([&]() {
+        for (int i = 0; i < 20000; ++i) {
+            map.assign(i % 100, i);
+        }
+    });
+    app::read_cache<int_map> other(map);
+    for (int i = 0; i < 20000; ++i) {
+        other.find(i % 100, value);
+    }
+    writer.join();
+    for (int i = 0; i < 100; ++i) {
+        CHECK(other.find(i, value) && value == 19900 + i);
+    }
+}
+
+int main()
+{
+    stats();
+    build();
+    cache();
+    return 0;
+}
@@ -0,0 +1,383 @@
+#pragma once
+
+#include <mutex>
+#include <atomic>
+#include <future>
+#include <memory>
+#include <random>
+#include <thread>
+#include <vector>
+#include <cstdint>
+#include <exception>
+#include <functional>
+#include <type_traits>
+#include <condition_variable>
+
+#if defined(__linux__)
+#   include <pthread.h>
+#   include <sched.h>
+#endif
+
+#include "spinlock.h"
+#include "safequeue.hpp"
+
+namespace app
+{
+
+/* Chase-Lev work stealing deque: the owner pushes and pops at the bottom,
+ * thieves steal from the top. T must be a pointer, nullptr means empty */
+template <typename T>
+class ws_deque
+{
+    struct ring
+    {
+        explicit ring(size_t cap)
+            : cap_(cap), buf_(new std::atomic<T>[cap])
+        {
+        }
+
+        T get(int64_t idx) const
+        {
+            return buf_[idx & (cap_ - 1)].load(std::memory_order_relaxed);
+        }
+
+        void put(int64_t idx, T val)
+        {
+            buf_[idx & (cap_ - 1)].store(val, std::memory_order_relaxed);
+        }
+
+        size_t                              cap_;
+        std::unique_ptr<std::atomic<T>[]>   buf_;
+    };
+
+public:
+    explicit ws_deque(size_t cap = 1024)
+    {
+        rings_.emplace_back(new ring(cap));
+        ring_.store(rings_.back().get(), std::memory_order_relaxed);
+    }
+
+    ~ws_deque() = default;
+
+    /* owner only */
+    void push(T val)
+    {
+        int64_t b = bottom_.load(std::memory_order_relaxed);
+        int64_t t = top_.load(std::memory_order_acquire);
+        ring* r = ring_.load(std::memory_order_relaxed);
+        if (b - t > int64_t(r->cap_) - 1) {
+            r = grow(r, t, b);
+        }
+
+        r->put(b, val);
+        std::atomic_thread_fence(std::memory_order_release);
+        bottom_.store(b + 1, std::memory_order_relaxed);
+    }
+
+    /* owner only */
+    T pop()
+    {
+        int64_t b = bottom_.load(std::memory_order_relaxed) - 1;
+        ring* r = ring_.load(std::memory_order_relaxed);
+        bottom_.store(b, std::memory_order_relaxed);
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+        int64_t t = top_.load(std::memory_order_relaxed);
+
+        if (t > b) {
+            bottom_.store(b + 1, std::memory_order_relaxed);
+            return nullptr;
+        }
+
+        T val = r->get(b);
+        if (t == b) {
+            // last element, race against thieves
+            if (!top_.compare_exchange_strong(t, t + 1, std::memory_order_seq_cst, std::memory_order_relaxed)) {
+                val = nullptr;
+            }
+            bottom_.store(b + 1, std::memory_order_relaxed);
+        }
+        return val;
+    }
+
+    /* any thread */
+    T steal()
+    {
+        int64_t t = top_.load(std::memory_order_acquire);
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+        int64_t b = bottom_.load(std::memory_order_acquire);
+        if (t >= b) {
+            return nullptr;
+        }
+
+        T val = ring_.load(std::memory_order_acquire)->get(t);
+        if (!top_.compare_exchange_strong(t, t + 1, std::memory_order_seq_cst, std::memory_order_relaxed)) {
+            return nullptr;
+        }
+        return val;
+    }
+
+    bool empty() const
+    {
+        return bottom_.load(std::memory_order_relaxed) <= top_.load(std::memory_order_relaxed);
+    }
+
+private:
+    /* old rings stay alive until the deque dies, thieves may still read them */
+    ring* grow(ring* old, int64_t t, int64_t b)
+    {
+        ring* r = new ring(old->cap_ * 2);
+        for (int64_t i = t; i < b; ++i) {
+            r->put(i, old->get(i));
+        }
+        rings_.emplace_back(r);
+        ring_.store(r, std::memory_order_release);
+        return r;
+    }
+
+private:
+    ws_deque(const ws_deque&) = delete;
+    ws_deque& operator=(const ws_deque&) = delete;
+
+private:
+    std::atomic<int64_t>                top_        { 0 };
+    char                                pad_[64 - sizeof(std::atomic<int64_t>)];
+    std::atomic<int64_t>                bottom_     { 0 };
+    std::atomic<ring*>                  ring_;
+    std::vector<std::unique_ptr<ring>>  rings_;
+};
+
+
+/* work stealing executor: per-worker Chase-Lev deques, random victim stealing,
+ * and a safe_queue for submits from threads outside the pool */
+class thread_pool
+{
+    typedef std::function<void()>   task;
+
+    struct worker
+    {
+        ws_deque<task*>     deque;
+        std::thread         thread;
+    };
+
+public:
+    explicit thread_pool(size_t threads = std::thread::hardware_concurrency(), bool pin = false)
+        : inject_("thread_pool")
+    {
+        threads = threads ? threads : 1;
+        for (size_t i = 0; i < threads; ++i) {
+            workers_.emplace_back(new worker());
+        }
+
+        for (size_t i = 0; i < threads; ++i) {
+            workers_[i]->thread = std::thread([this, i]() { run(i); });
+            if (pin) {
+                pin_thread(workers_[i]->thread, i);
+            }
+        }
+    }
+
+    /* runs every task already submitted, then joins the workers */
+    ~thread_pool()
+    {
+        {
+            std::lock_guard<std::mutex> lck(idle_mtx_);
+            stop_.store(true, std::memory_order_release);
+        }
+        idle_cond_.notify_all();
+
+        for (auto& w : workers_) {
+            w->thread.join();
+        }
+    }
+
+    size_t size() const
+    {
+        return workers_.size();
+    }
+
+    template <typename F, typename... Args>
+    auto submit(F&& f, Args&&... args) -> std::future<decltype(f(args...))>
+    {
+        typedef decltype(f(args...)) result_type;
+
+        auto job = std::make_shared<std::packaged_task<result_type()>>(
+            std::bind(std::forward<F>(f), std::forward<Args>(args)...));
+        std::future<result_type> fut = job->get_future();
+        post([job]() { (*job)(); });
+        return fut;
+    }
+
+    /* fire and forget, a worker pushes to its own deque, others to the injection queue */
+    void post(task fn)
+    {
+        task* t = new task(std::move(fn));
+        if (current_pool() == this) {
+            workers_[current_index()]->deque.push(t);
+        }
+        else {
+            inject_.push(t);
+        }
+
+        // pairs with the sleepers_ increment before has_work() in run()
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+        if (sleepers_.load(std::memory_order_relaxed) > 0) {
+            std::lock_guard<std::mutex> lck(idle_mtx_);
+            idle_cond_.notify_one();
+        }
+    }
+
+    /* fn(i) for i in [first, last), chunked to about 8 chunks per worker unless grain is given;
+     * the caller helps run tasks while waiting so it is safe to call from a worker. the first
+     * exception fn throws is rethrown here once every chunk is done, iterations not yet run
+     * by then are skipped */
+    template <typename F>
+    void parallel_for(size_t first, size_t last, F fn, size_t grain = 0)
+    {
+        if (first >= last) {
+            return;
+        }
+
+        size_t count = last - first;
+        grain = grain ? grain : std::max<size_t>(1, count / (workers_.size() * 8));
+        size_t chunks = (count + grain - 1) / grain;
+
+        std::atomic<size_t> remaining { chunks };
+        std::atomic<bool> failed { false };
+        std::exception_ptr error;
+        for (size_t c = 0; c < chunks; ++c) {
+            size_t lo = first + c * grain;
+            size_t hi = std::min(last, lo + grain);
+            post([&fn, &remaining, &failed, &error, lo, hi]() {
+                try {
+                    for (size_t i = lo; i < hi && !failed.load(std::memory_order_relaxed); ++i) {
+                        fn(i);
+                    }
+                }
+                catch (...) {
+                    if (!failed.exchange(true, std::memory_order_relaxed)) {
+                        error = std::current_exception();
+                    }
+                }
+                remaining.fetch_sub(1, std::memory_order_release);
+            });
+        }
+
+        for (spin_backoff backoff; remaining.load(std::memory_order_acquire) != 0;) {
+            if (!run_one()) {
+                backoff.pause();
+            }
+        }
+        if (error) {
+            std::rethrow_exception(error);
+        }
+    }
+
+private:
+    static thread_pool*& current_pool()
+    {
+        static thread_local thread_pool* pool = nullptr;
+        return pool;
+    }
+
+    static size_t& current_index()
+    {
+        static thread_local size_t index = 0;
+        return index;
+    }
+
+    static void pin_thread(std::thread& thread, size_t index)
+    {
+#if defined(__linux__)
+        cpu_set_t set;
+        CPU_ZERO(&set);
+        CPU_SET(index % std::max(1u, std::thread::hardware_concurrency()), &set);
+        pthread_setaffinity_np(thread.native_handle(), sizeof(set), &set);
+#else
+        (void)thread;
+        (void)index;
+#endif
+    }
+
+    task* find_task(std::minstd_rand& rng)
+    {
+        task* t = nullptr;
+        if (current_pool() == this) {
+            t = workers_[current_index()]->deque.pop();
+        }
+
+        if (t == nullptr && !inject_.try_pop(t)) {
+            t = nullptr;
+        }
+
+        for (size_t i = 0; t == nullptr && i < workers_.size(); ++i) {
+            t = workers_[rng() % workers_.size()]->deque.steal();
+        }
+        return t;
+    }
+
+    bool run_one()
+    {
+        static thread_local std::minstd_rand rng(std::hash<std::thread::id>()(std::this_thread::get_id()));
+        task* t = find_task(rng);
+        if (t == nullptr) {
+            return false;
+        }
+
+        std::unique_ptr<task> hold(t);
+        (*t)();
+        return true;
+    }
+
+    bool has_work() const
+    {
+        if (!inject_.empty()) {
+            return true;
+        }
+        for (auto& w : workers_) {
+            if (!w->deque.empty()) {
+                return true;
+            }
+        }
+        return false;
+    }
+
+    void run(size_t index)
+    {
+        current_pool() = this;
+        current_index() = index;
+
+        for (;;) {
+            if (run_one()) {
+                continue;
+            }
+
+            // either post() sees the sleeper and notifies under idle_mtx_, which is only
+            // released inside wait(), or has_work() sees its task
+            std::unique_lock<std::mutex> lck(idle_mtx_);
+            sleepers_.fetch_add(1, std::memory_order_relaxed);
+            std::atomic_thread_fence(std::memory_order_seq_cst);
+            if (!has_work()) {
+                if (stop_.load(std::memory_order_acquire)) {
+                    sleepers_.fetch_sub(1, std::memory_order_relaxed);
+                    return;
+                }
+                idle_cond_.wait(lck);
+            }
+            sleepers_.fetch_sub(1, std::memory_order_relaxed);
+        }
+    }
+
+private:
+    thread_pool(const thread_pool&) = delete;
+    thread_pool& operator=(const thread_pool&) = delete;
+
+private:
+    std::vector<std::unique_ptr<worker>>    workers_;
+    safe_queue<task*>                       inject_;
+    std::mutex                              idle_mtx_;
+    std::condition_variable                 idle_cond_;
+    std::atomic<size_t>                     sleepers_   { 0 };
+    std::atomic<bool>                       stop_       { false };
+};
+
+};
@@ -2,21 +2,256 @@
 
 #include <unordered_map>
 #include <mutex>
+#include <atomic>
+#include <chrono>
+#include <memory>
+#include <thread>
+#include <vector>
+#include <numeric>
+#include <iterator>
+#include <algorithm>
+#include <functional>
+#include <initializer_list>
+
+#include "lock_profile.h"
 
 namespace app
 {
 
+/* snapshot returned by unordered_map::stats() */
+struct unordered_map_stats
+{
+    size_t      size;
+    size_t      bucket_count;
+    float       load_factor;
+    float       max_load_factor;
+    size_t      bucket_sizes[9];        // walked buckets holding 0..7 elements, [8] is 8 or more
+    size_t      max_chain;
+    size_t      rehashes;
+    uint64_t    rehash_ns;
+    uint64_t    rehash_max_ns;
+    uint64_t    lock_acquisitions;
+    uint64_t    lock_contended;
+    uint64_t    lock_wait_ns;
+    uint64_t    lock_wait_max_ns;
+    std::vector<std::pair<int64_t, float> > load_history;  // (steady clock ns, load factor), oldest first
+};
+
 template<typename _Key,
          typename _Tp,
-         typename _Hash = hash<_Key>,
+         typename _Hash = std::hash<_Key>,
          typename _Pred = std::equal_to<_Key>,
          typename _Alloc = std::allocator<std::pair<const _Key, _Tp> > >
 
 class unordered_map
 {
 private:
+    typedef std::chrono::steady_clock                        clock;
+    typedef std::pair<int64_t, float>                        load_sample;
+    enum { history = 32 };
+
     std::unordered_map<_Key, _Tp, _Hash, _Pred, _Alloc>      map_;
-    mutable std::recursive_mutex                             mtx_;
+    mutable counted_lock<std::recursive_mutex>               mtx_;
+
+    /* locks through counted_lock so stats() sees every acquisition */
+    typedef std::unique_lock<counted_lock<std::recursive_mutex> > counted_unique_lock;
+
+    /* rehash and load factor history, guarded by mtx_ */
+    size_t                                                   rehashes_       { 0 };
+    uint64_t                                                 rehash_ns_      { 0 };
+    uint64_t                                                 rehash_max_ns_  { 0 };
+    mutable load_sample                                      history_[history];
+    mutable size_t                                           history_pos_    { 0 };
+
+    /* per-shard versions for read_cache: bumped under mtx_ whenever a value of a key in
+     * the shard may change or go away, read without the lock. inserting a new key bumps
+     * nothing, a cache only ever holds keys that were present. unpadded on purpose, many
+     * small shards keep a write from dropping unrelated cached keys. allocated when the
+     * first read_cache attaches and never moved after, until then bump() does nothing */
+    enum { version_shards = 1024 };
+
+    mutable std::unique_ptr<std::atomic<uint64_t>[]>         versions_;
+
+    /* (thread, shard) of an operator[] reference that may still be written, at most one
+     * per thread, guarded by mtx_. caches do not store values of a pending shard; the
+     * thread's next call into the map comes after the write and bumps the shard again */
+    mutable std::vector<std::pair<std::thread::id, size_t> > pending_;
+
+    /* locks mtx_ for one call, settling the calling thread's pending shard first */
+    class guard
+    {
+    public:
+        explicit guard(const unordered_map& m)
+            : lck_(m.mtx_)
+        {
+            if (!m.pending_.empty()) {
+                m.settle();
+            }
+        }
+
+        void lock()
+        {
+            lck_.lock();
+        }
+
+        void unlock()
+        {
+            lck_.unlock();
+        }
+
+    private:
+        counted_unique_lock     lck_;
+    };
+
+    /* detects table growth around an insert, reads the clock only when a rehash is due */
+    class rehash_probe
+    {
+    public:
+        rehash_probe(unordered_map& m, size_t adding)
+            : m_(m), buckets_(m.map_.bucket_count())
+        {
+            if (adding == size_t(-1) || m.map_.size() + adding > m.map_.max_load_factor() * buckets_) {
+                start_ = clock::now();
+            }
+        }
+
+        ~rehash_probe()
+        {
+            if (m_.map_.bucket_count() != buckets_) {
+                m_.rehashed(start_);
+            }
+        }
+
+    private:
+        unordered_map&          m_;
+        size_t                  buckets_;
+        clock::time_point       start_;
+    };
+
+    void rehashed(clock::time_point start)
+    {
+        uint64_t ns = start == clock::time_point() ? 0 : lock_stats::since(start);
+        ++rehashes_;
+        rehash_ns_ += ns;
+        rehash_max_ns_ = std::max(rehash_max_ns_, ns);
+        sample_load();
+    }
+
+    static size_t version_shard(size_t __h)
+    {
+        return size_t((uint64_t(__h) * 0x9e3779b97f4a7c15ull) >> 54);
+    }
+
+    /* writers hold mtx_, a plain load and store is enough */
+    void bump_shard(size_t __shard) const
+    {
+        if (versions_) {
+            std::atomic<uint64_t>& v = versions_[__shard];
+            v.store(v.load(std::memory_order_relaxed) + 1, std::memory_order_release);
+        }
+    }
+
+    void bump(const _Key& __x)
+    {
+        if (versions_) {
+            bump_shard(version_shard(map_.hash_function()(__x)));
+        }
+    }
+
+    void bump_all()
+    {
+        if (versions_) {
+            for (size_t i = 0; i < version_shards; ++i) {
+                bump_shard(i);
+            }
+        }
+    }
+
+    void settle() const
+    {
+        std::thread::id id = std::this_thread::get_id();
+        for (size_t i = 0; i < pending_.size(); ++i) {
+            if (pending_[i].first == id) {
+                bump_shard(pending_[i].second);
+                pending_[i] = pending_.back();
+                pending_.pop_back();
+                return;
+            }
+        }
+    }
+
+    /* operator[] hands out a reference the caller writes after the lock is gone */
+    void defer_bump(const _Key& __x)
+    {
+        size_t shard = version_shard(map_.hash_function()(__x));
+        bump_shard(shard);
+        pending_.emplace_back(std::this_thread::get_id(), shard);
+    }
+
+    bool is_pending(size_t __shard) const
+    {
+        for (auto& p : pending_) {
+            if (p.second == __shard) {
+                return true;
+            }
+        }
+        return false;
+    }
+
+    void sample_load() const
+    {
+        int64_t now = std::chrono::duration_cast<std::chrono::nanoseconds>(clock::now().time_since_epoch()).count();
+        history_[history_pos_++ % history] = load_sample(now, map_.load_factor());
+    }
+
+    /* runs __fn(t) for t in [0, __n) on __n threads, the caller takes t = 0 */
+    template<typename _Fn>
+    static void run_threads(size_t __n, _Fn& __fn)
+    {
+        std::vector<std::thread> workers;
+        for (size_t t = 1; t < __n; ++t) {
+            workers.emplace_back([&__fn, t]() { __fn(t); });
+        }
+        __fn(0);
+        for (auto& w : workers) {
+            w.join();
+        }
+    }
+
+    /* runs __fill(part, t, n) for t in [0, n) on n threads, each part is a private table
+     * the result is later spliced from */
+    template<typename _Fill>
+    static std::vector<std::unordered_map<_Key, _Tp, _Hash, _Pred, _Alloc> >
+    build_parts(size_t __n, const _Hash& __hf, const _Pred& __eql, const _Alloc& __a, _Fill __fill)
+    {
+        std::vector<std::unordered_map<_Key, _Tp, _Hash, _Pred, _Alloc> > parts;
+        for (size_t t = 0; t < __n; ++t) {
+            parts.emplace_back(0, __hf, __eql, __a);
+        }
+
+        auto fn = [&parts, &__fill, __n](size_t t) { __fill(parts[t], t, __n); };
+        run_threads(__n, fn);
+        return parts;
+    }
+
+    /* one builder thread per 16384 elements at most, below that the threads cost more than they save */
+    static size_t build_threads(size_t __requested, size_t __count)
+    {
+        size_t n = __requested ? __requested : 1;
+        return std::max<size_t>(1, std::min(n, __count / 16384));
+    }
+
+    /* which of __n builders owns a hash, mixed so identity hashes of strided keys still spread */
+    static size_t build_partition(size_t __h, size_t __n)
+    {
+        return size_t((((uint64_t(__h) * 0x9e3779b97f4a7c15ull) >> 32) * __n) >> 32);
+    }
+
+    struct build_identity
+    {
+        template<typename _T>
+        const _T& operator()(const _T& __x) const { return __x; }
+    };
 
 public:
     using map_type              = std::unordered_map<_Key, _Tp, _Hash, _Pred, _Alloc>;
@@ -37,7 +272,10 @@ public:
     using size_type             = typename map_type::size_type;
     using difference_type       = typename map_type::difference_type;
 
-    typedef std::unique_lock<std::recursive_mutex>  lock;
+    typedef std::unique_lock<std::recursive_mutex>           lock;
+
+    /* version find() reports for a value that must not be cached */
+    static const uint64_t uncached_version = ~uint64_t(0);
 
     unordered_map() = default;
     unordered_map(const unordered_map&) = delete;
@@ -83,7 +321,7 @@ public:
         : map_(std::move(__umap), __a)
     {}
 
-    unordered_map(initializer_list<value_type> __l,
+    unordered_map(std::initializer_list<value_type> __l,
                   size_type __n = 0,
                   const hasher& __hf = hasher(),
                   const key_equal& __eql = key_equal(),
@@ -114,79 +352,82 @@ public:
         : unordered_map(__first, __last, __n, __hf, key_equal(), __a)
     {}
 
-    unordered_map(initializer_list<value_type> __l,
+    unordered_map(std::initializer_list<value_type> __l,
                   size_type __n,
                   const allocator_type& __a)
         : unordered_map(__l, __n, hasher(), key_equal(), __a)
     {}
 
-    unordered_map(initializer_list<value_type> __l,
+    unordered_map(std::initializer_list<value_type> __l,
                   size_type __n, const hasher& __hf,
                   const allocator_type& __a)
         : unordered_map(__l, __n, __hf, key_equal(), __a)
     {}
 
     bool empty() const noexcept {
-        lock lck(mtx_);
+        guard lck(*this);
         return map_.empty();
     }
 
     size_type size() const noexcept {
-        lock lck(mtx_);
+        guard lck(*this);
         return map_.size();
     }
 
     size_type max_size() const noexcept {
-        lock lck(mtx_);
+        guard lck(*this);
         return map_.max_size();
     }
 
     iterator begin() noexcept {
-        lock lck(mtx_);
+        guard lck(*this);
         return map_.begin();
     }
 
     const_iterator begin() const noexcept {
-        lock lck(mtx_);
+        guard lck(*this);
         return map_.begin();
     }
 
     const_iterator cbegin() const noexcept {
-        lock lck(mtx_);
+        guard lck(*this);
         return map_.cbegin();
     }
 
     iterator end() noexcept {
-        lock lck(mtx_);
+        guard lck(*this);
         return map_.end();
     }
 
     const_iterator end() const noexcept {
-        lock lck(mtx_);
+        guard lck(*this);
         return map_.end();
     }
 
     const_iterator cend() const noexcept {
-        lock lck(mtx_);
+        guard lck(*this);
         return map_.cend();
     }
 
     template<typename... _Args>
     std::pair<iterator, bool>
     emplace(_Args&& ... __args) {
-        lock lck(mtx_);
+        guard lck(*this);
+        rehash_probe probe(*this, 1);
         return map_.emplace(std::forward<_Args>(__args)...);
     }
 
     template<typename... _Args>
     iterator
     emplace_hint(const_iterator __pos, _Args&& ... __args) {
-        lock lck(mtx_);
+        guard lck(*this);
+        rehash_probe probe(*this, 1);
         return map_.emplace_hint(__pos, std::forward<_Args>(__args)...);
     }
 
     std::pair<iterator, bool> insert(const value_type& __x) {
-        lock lck(mtx_);
+        guard lck(*this);
+        rehash_probe probe(*this, 1);
         return map_.insert(__x);
     }
 
@@ -195,13 +436,15 @@ public:
                                 _Pair && >::value >::type >
     std::pair<iterator, bool>
     insert(_Pair && __x) {
-        lock lck(mtx_);
+        guard lck(*this);
+        rehash_probe probe(*this, 1);
         return map_.insert(std::forward<_Pair>(__x));
     }
 
     iterator
     insert(const_iterator __hint, const value_type& __x) {
-        lock lck(mtx_);
+        guard lck(*this);
+        rehash_probe probe(*this, 1);
         return map_.insert(__hint, __x);
     }
 
@@ -210,185 +453,342 @@ public:
                                 _Pair && >::value >::type >
     iterator
     insert(const_iterator __hint, _Pair && __x) {
-        lock lck(mtx_);
+        guard lck(*this);
+        rehash_probe probe(*this, 1);
         return map_.insert(__hint, std::forward<_Pair>(__x));
     }
 
     template<typename _InputIterator>
     void
     insert(_InputIterator __first, _InputIterator __last) {
-        lock lck(mtx_);
+        guard lck(*this);
+        rehash_probe probe(*this, size_t(-1));
         map_.insert(__first, __last);
     }
 
-    void insert(initializer_list<value_type> __l) {
-        lock lck(mtx_);
+    void insert(std::initializer_list<value_type> __l) {
+        guard lck(*this);
+        rehash_probe probe(*this, __l.size());
         map_.insert(__l);
     }
 
+#if __cplusplus >= 201703L
+    /* splices the nodes of __source in without reallocating them, keys already present stay in __source */
+    template<typename _H2, typename _P2>
+    void merge(std::unordered_map<_Key, _Tp, _H2, _P2, _Alloc>& __source) {
+        guard lck(*this);
+        rehash_probe probe(*this, __source.size());
+        map_.merge(__source);
+    }
+#endif
+
+    /* same result as insert(__first, __last), the first of equal keys wins. */
+    template<typename _RandomIt>
+    size_type parallel_build(_RandomIt __first, _RandomIt __last,
+                             size_t __nthreads = std::thread::hardware_concurrency()) {
+        return parallel_build(__first, __last, __nthreads, build_identity());
+    }
+
+    /* inserts __proj(e) for every e in [__first, __last), the first of equal keys wins.
+     * every thread sorts the positions of a contiguous slice of the input by a mix of
+     * their hash, then builds the nodes of one hash partition in a private table without
+     * the lock, walking the slices in input order; the tables hold disjoint keys, so
+     * duplicates are dropped in parallel. splicing the tables in stays serial: merge()
+     * rehashes and links every node under the lock, and std::unordered_map offers no way
+     * to fill disjoint regions of one table concurrently. the splice costs about two
+     * thirds of a serial insert of cheap keys, so the speedup stays below ~1.5x with any
+     * thread count; it pays off when hashing, comparing or constructing the elements
+     * dominates. returns the number of elements inserted */
+    template<typename _RandomIt, typename _Proj>
+    size_type parallel_build(_RandomIt __first, _RandomIt __last, size_t __nthreads, _Proj __proj) {
+        size_t count = size_t(std::distance(__first, __last));
+#if __cplusplus >= 201703L
+        size_t n = build_threads(__nthreads, count);
+        if (n > 1) {
+            guard lck(*this);
+            hasher hf = map_.hash_function();
+            key_equal eql = map_.key_eq();
+            allocator_type a = map_.get_allocator();
+            lck.unlock();
+
+            // positions[s][p]: positions in slice s whose key belongs to partition p
+            std::vector<std::vector<std::vector<size_t> > > positions(n, std::vector<std::vector<size_t> >(n));
+            auto split = [&](size_t s) {
+                size_t lo = count * s / n;
+                size_t hi = count * (s + 1) / n;
+                for (auto& p : positions[s]) {
+                    p.reserve((hi - lo) / n + (hi - lo) / (4 * n) + 16);
+                }
+                for (size_t i = lo; i < hi; ++i) {
+                    positions[s][build_partition(hf(__proj(__first[i]).first), n)].push_back(i);
+                }
+            };
+            run_threads(n, split);
+
+            auto parts = build_parts(n, hf, eql, a, [&](map_type& part, size_t p, size_t nt) {
+                size_t total = 0;
+                for (size_t s = 0; s < nt; ++s) {
+                    total += positions[s][p].size();
+                }
+                part.reserve(total);
+                for (size_t s = 0; s < nt; ++s) {
+                    for (size_t i : positions[s][p]) {
+                        part.emplace(__proj(__first[i]));
+                    }
+                }
+            });
+
+            lck.lock();
+            rehash_probe probe(*this, size_t(-1));
+            size_type before = map_.size();
+            map_.reserve(before + std::accumulate(parts.begin(), parts.end(), size_t(0),
+                                                  [](size_t sum, const map_type& part) { return sum + part.size(); }));
+            for (auto& part : parts) {
+                map_.merge(part);
+            }
+            return map_.size() - before;
+        }
+#else
+        (void)__nthreads;
+#endif
+        guard lck(*this);
+        rehash_probe probe(*this, size_t(-1));
+        size_type before = map_.size();
+        map_.reserve(before + count);
+        for (; __first != __last; ++__first) {
+            map_.emplace(__proj(*__first));
+        }
+        return map_.size() - before;
+    }
+
+    template<typename _Range>
+    size_type parallel_build(const _Range& __range,
+                             size_t __nthreads = std::thread::hardware_concurrency()) {
+        return parallel_build(std::begin(__range), std::end(__range), __nthreads);
+    }
+
+    /* copies every element of __other whose key is not here yet, like insert(__other.begin(),
+     * __other.end()). both maps stay locked throughout; each thread copies a disjoint run of
+     * __other's buckets into a private table, the tables are spliced in serially at the end,
+     * which bounds the speedup the same way as parallel_build.
+     * returns the number of elements inserted */
+    size_type parallel_merge(const unordered_map& __other,
+                             size_t __nthreads = std::thread::hardware_concurrency()) {
+        if (&__other == this) {
+            return 0;
+        }
+
+        counted_unique_lock lck(mtx_, std::defer_lock);
+        counted_unique_lock other(__other.mtx_, std::defer_lock);
+        std::lock(lck, other);
+        rehash_probe probe(*this, size_t(-1));
+        size_type before = map_.size();
+#if __cplusplus >= 201703L
+        size_t n = build_threads(__nthreads, __other.map_.size());
+        if (n > 1) {
+            size_t buckets = __other.map_.bucket_count();
+            auto parts = build_parts(n, map_.hash_function(), map_.key_eq(), map_.get_allocator(),
+                                     [&](map_type& part, size_t t, size_t nt) {
+                for (size_t b = buckets * t / nt; b < buckets * (t + 1) / nt; ++b) {
+                    for (auto it = __other.map_.begin(b); it != __other.map_.end(b); ++it) {
+                        if (map_.find(it->first) == map_.end()) {
+                            part.insert(*it);
+                        }
+                    }
+                }
+            });
+
+            map_.reserve(before + std::accumulate(parts.begin(), parts.end(), size_t(0),
+                                                  [](size_t sum, const map_type& part) { return sum + part.size(); }));
+            for (auto& part : parts) {
+                map_.merge(part);
+            }
+            return map_.size() - before;
+        }
+#else
+        (void)__nthreads;
+#endif
+        map_.reserve(before + __other.map_.size());
+        map_.insert(__other.map_.begin(), __other.map_.end());
+        return map_.size() - before;
+    }
+
     iterator erase(const_iterator __position) {
-        lock lck(mtx_);
+        guard lck(*this);
+        bump(__position->first);
         return map_.erase(__position);
     }
 
     iterator erase(iterator __position) {
-        lock lck(mtx_);
+        guard lck(*this);
+        bump(__position->first);
         return map_.erase(__position);
     }
 
     size_type erase(const key_type& __x) {
-        lock lck(mtx_);
+        guard lck(*this);
+        bump(__x);
         return map_.erase(__x);
     }
 
     iterator erase(const_iterator __first, const_iterator __last) {
-        lock lck(mtx_);
+        guard lck(*this);
+        bump_all();
         return map_.erase(__first, __last);
     }
 
     void clear() noexcept {
-        lock lck(mtx_);
+        guard lck(*this);
+        bump_all();
         map_.clear();
     }
 
     void swap(map_type& __x) noexcept(noexcept(map_.swap(__x._M_h))) {
-        lock lck(mtx_);
+        guard lck(*this);
+        bump_all();
         map_.swap(__x._M_h);
     }
 
     hasher hash_function() const {
-        lock lck(mtx_);
+        guard lck(*this);
         return map_.hash_function();
     }
 
     key_equal key_eq() const {
-        lock lck(mtx_);
+        guard lck(*this);
         return map_.key_eq();
     }
 
     iterator find(const key_type& __x) {
-        lock lck(mtx_);
+        guard lck(*this);
         return map_.find(__x);
     }
 
     const_iterator find(const key_type& __x) const {
-        lock lck(mtx_);
+        guard lck(*this);
         return map_.find(__x);
     }
 
     size_type count(const key_type& __x) const {
-        lock lck(mtx_);
+        guard lck(*this);
         return map_.count(__x);
     }
 
     std::pair<iterator, iterator> equal_range(const key_type& __x) {
-        lock lck(mtx_);
+        guard lck(*this);
         return map_.equal_range(__x);
     }
 
     std::pair<const_iterator, const_iterator>
     equal_range(const key_type& __x) const {
-        lock lck(mtx_);
+        guard lck(*this);
         return map_.equal_range(__x);
     }
 
     mapped_type& operator[](const key_type& __k) {
-        lock lck(mtx_);
+        guard lck(*this);
+        rehash_probe probe(*this, 1);
+        defer_bump(__k);
         return map_[__k];
     }
 
     mapped_type& operator[](key_type&& __k) {
-        lock lck(mtx_);
+        guard lck(*this);
+        rehash_probe probe(*this, 1);
+        defer_bump(__k);
         return map_[std::move(__k)];
     }
 
     mapped_type& at(const key_type& __k) {
-        lock lck(mtx_);
+        guard lck(*this);
         return map_.at(__k);
     }
 
     const mapped_type& at(const key_type& __k) const {
-        lock lck(mtx_);
+        guard lck(*this);
         return map_.at(__k);
     }
 
     size_type bucket_count() const noexcept {
-        lock lck(mtx_);
+        guard lck(*this);
         return map_.bucket_count();
     }
 
     size_type max_bucket_count() const noexcept {
-        lock lck(mtx_);
+        guard lck(*this);
         return map_.max_bucket_count();
     }
 
     size_type bucket_size(size_type __n) const {
-        lock lck(mtx_);
+        guard lck(*this);
         return map_.bucket_size(__n);
     }
 
     size_type bucket(const key_type& __key) const {
-        lock lck(mtx_);
+        guard lck(*this);
         return map_.bucket(__key);
     }
 
     local_iterator begin(size_type __n) {
-        lock lck(mtx_);
+        guard lck(*this);
         return map_.begin(__n);
     }
 
     const_local_iterator begin(size_type __n) const {
-        lock lck(mtx_);
+        guard lck(*this);
         return map_.begin(__n);
     }
 
     const_local_iterator cbegin(size_type __n) const {
-        lock lck(mtx_);
+        guard lck(*this);
         return map_.cbegin(__n);
     }
 
     local_iterator end(size_type __n) {
-        lock lck(mtx_);
+        guard lck(*this);
         return map_.end(__n);
     }
 
     const_local_iterator end(size_type __n) const {
-        lock lck(mtx_);
+        guard lck(*this);
         return map_.end(__n);
     }
 
     const_local_iterator cend(size_type __n) const {
-        lock lck(mtx_);
+        guard lck(*this);
         return map_.cend(__n);
     }
 
     float load_factor() const noexcept {
-        lock lck(mtx_);
+        guard lck(*this);
         return map_.load_factor();
     }
 
     float max_load_factor() const noexcept {
-        lock lck(mtx_);
+        guard lck(*this);
         return map_.max_load_factor();
     }
 
     void max_load_factor(float __z) {
-        lock lck(mtx_);
+        guard lck(*this);
+        rehash_probe probe(*this, size_t(-1));
         map_.max_load_factor(__z);
     }
 
     void rehash(size_type __n) {
-        lock lck(mtx_);
+        guard lck(*this);
+        rehash_probe probe(*this, size_t(-1));
         map_.rehash(__n);
     }
 
     void reserve(size_type __n) {
-        lock lck(mtx_);
+        guard lck(*this);
+        rehash_probe probe(*this, size_t(-1));
         map_.reserve(__n);
     }
 
     bool find(const key_type& __x, mapped_type& value) const {
-        lock lck(mtx_);
+        guard lck(*this);
         auto it = map_.find(__x);
         auto found = it != map_.end();
         if (found) {
@@ -397,13 +797,93 @@ public:
         return found;
     }
 
+    /* find plus the version of the key's shard, read together under the lock.
+     * the version is uncached_version while an operator[] write to the shard is pending */
+    bool find(const key_type& __x, mapped_type& value, uint64_t& version) const {
+        guard lck(*this);
+        size_t shard = version_shard(map_.hash_function()(__x));
+        version = !versions_ || is_pending(shard)
+                ? uncached_version : versions_[shard].load(std::memory_order_relaxed);
+        auto it = map_.find(__x);
+        auto found = it != map_.end();
+        if (found) {
+            value = it->second;
+        }
+        return found;
+    }
+
+    /* lock free, version of the shard holding keys that hash to __h; only after attach_cache() */
+    uint64_t version(size_t __h) const noexcept {
+        return versions_[version_shard(__h)].load(std::memory_order_acquire);
+    }
+
+    /* allocates the shard versions, called by read_cache before its first lookup */
+    void attach_cache() const {
+        guard lck(*this);
+        if (!versions_) {
+            versions_.reset(new std::atomic<uint64_t>[version_shards]());
+        }
+    }
+
+    /* read_cache sees a write through an operator[] reference once the writing thread
+     * calls into the map again. writes through at() or iterators (find(), begin()) need
+     * touch(key). assign() and replace() need neither */
+    void touch(const key_type& __x) {
+        guard lck(*this);
+        bump(__x);
+    }
+
+    /* cheap to leave on: contention counters and rehash timing are kept all the time,
+     * only the bucket walk happens here. by default it visits every bucket, O(bucket_count)
+     * under the lock, and max_chain is exact. sample_buckets > 0 looks at that many buckets
+     * evenly strided across the table instead, bounding the time under the lock, but then
+     * bucket_sizes and max_chain cover the sampled buckets only and can miss a long chain.
+     * a max_chain far above the load factor points at a bad hash or hash flooding */
+    unordered_map_stats stats(size_type sample_buckets = 0) const {
+        guard lck(*this);
+        unordered_map_stats st = unordered_map_stats();
+        st.size = map_.size();
+        st.bucket_count = map_.bucket_count();
+        st.load_factor = map_.load_factor();
+        st.max_load_factor = map_.max_load_factor();
+
+        size_type stride = sample_buckets == 0 || sample_buckets >= st.bucket_count
+                         ? 1 : st.bucket_count / sample_buckets;
+        for (size_type n = 0; n < st.bucket_count; n += stride) {
+            size_type len = map_.bucket_size(n);
+            ++st.bucket_sizes[std::min<size_type>(len, 8)];
+            st.max_chain = std::max<size_t>(st.max_chain, len);
+        }
+
+        st.rehashes = rehashes_;
+        st.rehash_ns = rehash_ns_;
+        st.rehash_max_ns = rehash_max_ns_;
+        st.lock_acquisitions = mtx_.acquisitions();
+        st.lock_contended = mtx_.contended();
+        st.lock_wait_ns = mtx_.wait_ns();
+        st.lock_wait_max_ns = mtx_.wait_max_ns();
+
+        sample_load();
+        size_t count = std::min<size_t>(history_pos_, history);
+        for (size_t i = history_pos_ - count; i < history_pos_; ++i) {
+            st.load_history.push_back(history_[i % history]);
+        }
+        return st;
+    }
+
+    /* counted like every other acquisition, the lock adopts it */
     lock get_lock()const noexcept {
-        return std::move(lock(mtx_));
+        mtx_.lock();
+        if (!pending_.empty()) {
+            settle();
+        }
+        return lock(mtx_, std::adopt_lock);
     }
 
     /* if not find then insert otherwise do nothing */
     mapped_type try_insert(const key_type& key, const mapped_type& value) {
-        lock lck(mtx_);
+        guard lck(*this);
+        rehash_probe probe(*this, 1);
         auto it = map_.find(key);
         if (it == map_.end()) {
             map_.insert(std::move(value_type(key, value)));
@@ -413,7 +893,8 @@ public:
     }
 
     bool try_insert(const key_type& key, mapped_type&& value) {
-        lock lck(mtx_);
+        guard lck(*this);
+        rehash_probe probe(*this, 1);
         auto it = map_.find(key);
         if (it == map_.end()) {
             map_.insert(std::move(value_type(key, std::move(value))));
@@ -423,26 +904,41 @@ public:
     }
 
     std::shared_ptr<mapped_type> replace(const key_type& key, const mapped_type& value) {
-        lock lck(mtx_);
+        guard lck(*this);
         auto it = map_.find(key);
         if (it != map_.end()) {
             auto ret = std::make_shared<mapped_type>(it->second);
-            map_.insert(std::move(value_type(key, value)));
+            it->second = value;
+            bump(key);
             return ret;
         }
         return std::shared_ptr<mapped_type>();
     }
 
     bool replace(const key_type& key, const mapped_type& value, const mapped_type& newvalue) {
-        lock lck(mtx_);
+        guard lck(*this);
         auto it = map_.find(key);
         if (it != map_.end() && it->second == value) {
-            map_.insert(std::move(value_type(key, newvalue)));
+            it->second = newvalue;
+            bump(key);
             return true;
         }
         return false;
     }
 
+    /* inserts or overwrites under the lock, true if the key was new. the write path
+     * read_cache always sees: the shard is bumped after the store */
+    bool assign(const key_type& key, const mapped_type& value) {
+        guard lck(*this);
+        rehash_probe probe(*this, 1);
+        auto ret = map_.insert(value_type(key, value));
+        if (!ret.second) {
+            ret.first->second = value;
+        }
+        bump(key);
+        return ret.second;
+    }
+
     template<typename _Key1, typename _Tp1, typename _Hash1, typename _Pred1,
              typename _Alloc1>
     friend bool